@@ -0,0 +1,2086 @@
+//
+//  librif_bench.c
+//  librif
+//
+//  Decoder benchmarks for non-Playdate builds.
+//
+//  make librif_bench (or cc -O2 -I../src librif_bench.c ../src/librif.c -lm -pthread -o librif_bench)
+//  ./librif_bench [image.rifc ...]
+//  ./librif_bench --json [image ...] > results.json
+//
+//  --json measures open latency, read throughput by chunk size, sequential and random get_pixel
+//  and decompression on the sample images and synthetic maps up to 8192x8192, written to the
+//  working directory on the first run. Image arguments are paths without the extension.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "librif.h"
+
+#ifdef RIF_TEST
+// test-only, exported by librif.c when built with RIF_TEST
+bool librif_check_decode(void);
+#endif
+
+static const char *defaultFilenames[] = {
+    "../images/track-512.rifc",
+    "../images/track-1024.rifc"
+};
+
+static uint32_t bench_random_state = 1;
+
+static uint32_t bench_random(void){
+    // xorshift32
+    uint32_t x = bench_random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    bench_random_state = x;
+    return x;
+}
+
+static double bench_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// reference decompression, one librif_cimage_get_pixel call per pixel
+static void decompress_per_pixel(RIF_CImage *cimage, RIF_Image *image){
+    
+    for(int y = 0; y < image->height; y++){
+        for(int x = 0; x < image->width; x++){
+            
+            uint8_t color, alpha;
+            librif_cimage_get_pixel(cimage, x, y, &color, &alpha);
+            
+            if(image->hasAlpha){
+                size_t i = (y * image->width + x) * 2;
+                image->pixels[i] = color;
+                image->pixels[i + 1] = alpha;
+            }
+            else {
+                image->pixels[y * image->width + x] = color;
+            }
+        }
+    }
+}
+
+static void bench_decompress(const char *filename){
+    
+    RIF_CImage *cimage = librif_cimage_open(filename, NULL);
+    if(cimage == NULL){
+        printf("%s: can't open\n", filename);
+        return;
+    }
+    
+    librif_cimage_read(cimage, 0, NULL);
+    
+    int iterations = 20;
+    
+    RIF_Image *reference = librif_cimage_decompress(cimage, NULL);
+    size_t size = reference->hasAlpha ? reference->width * reference->height * 2 : reference->width * reference->height;
+    
+    double start = bench_now();
+    for(int i = 0; i < iterations; i++){
+        decompress_per_pixel(cimage, reference);
+    }
+    double perPixelTime = (bench_now() - start) / iterations;
+    
+    start = bench_now();
+    for(int i = 0; i < iterations; i++){
+        RIF_Image *image = librif_cimage_decompress(cimage, NULL);
+        librif_image_free(image);
+    }
+    double blitTime = (bench_now() - start) / iterations;
+    
+    start = bench_now();
+    for(int i = 0; i < iterations; i++){
+        RIF_Image *image = librif_cimage_decompress_parallel(cimage, NULL, 0);
+        librif_image_free(image);
+    }
+    double parallelTime = (bench_now() - start) / iterations;
+    
+    double mb = size / (1000.0 * 1000.0);
+    
+    printf("%s: %dx%d, pattern %u\n", filename, cimage->width, cimage->height, cimage->patternSize);
+    printf("  decompress per-pixel  %8.3f ms  %8.1f MB/s\n", perPixelTime * 1000, mb / perPixelTime);
+    printf("  decompress tile-blit  %8.3f ms  %8.1f MB/s\n", blitTime * 1000, mb / blitTime);
+    printf("  decompress parallel   %8.3f ms  %8.1f MB/s\n", parallelTime * 1000, mb / parallelTime);
+    
+    librif_image_free(reference);
+    librif_cimage_free(cimage);
+}
+
+// 400x240 viewports, per-pixel calls against copy_rect
+static void bench_viewport(const char *filename){
+    
+    RIF_CImage *cimage = librif_cimage_open(filename, NULL);
+    if(cimage == NULL){
+        return;
+    }
+    
+    librif_cimage_read(cimage, 0, NULL);
+    
+    int width = 400;
+    int height = 240;
+    int frames = 200;
+    
+    uint8_t *viewport = malloc(width * height);
+    unsigned int sum = 0;
+    
+    double start = bench_now();
+    for(int frame = 0; frame < frames; frame++){
+        int x0 = frame * 3 % cimage->width;
+        int y0 = frame * 2 % cimage->height;
+        for(int y = 0; y < height; y++){
+            for(int x = 0; x < width; x++){
+                librif_cimage_get_pixel(cimage, x0 + x, y0 + y, &viewport[y * width + x], NULL);
+            }
+        }
+        sum += viewport[frame];
+    }
+    double perPixelTime = (bench_now() - start) / frames;
+    
+    start = bench_now();
+    for(int frame = 0; frame < frames; frame++){
+        librif_cimage_copy_rect(cimage, frame * 3 % cimage->width, frame * 2 % cimage->height, width, height, viewport, width, RIF_PixelFormatColor);
+        sum += viewport[frame];
+    }
+    double copyTime = (bench_now() - start) / frames;
+    
+    start = bench_now();
+    for(int frame = 0; frame < frames; frame++){
+        int x0 = frame * 3 % cimage->width;
+        RIF_CImageRow row;
+        librif_cimage_row_init(&row, cimage, frame * 2 % cimage->height, x0, x0 + width, RIF_PixelFormatColor);
+        for(int y = 0; y < height; y++){
+            librif_cimage_row_next(&row, &viewport[y * width]);
+        }
+        librif_cimage_row_release(&row);
+        sum += viewport[frame];
+    }
+    double rowTime = (bench_now() - start) / frames;
+    
+    printf("  viewport 400x240 get_pixel   %8.3f ms\n", perPixelTime * 1000);
+    printf("  viewport 400x240 copy_rect   %8.3f ms\n", copyTime * 1000);
+    printf("  viewport 400x240 row cursor  %8.3f ms  (checksum %u)\n", rowTime * 1000, sum);
+    
+    free(viewport);
+    librif_cimage_free(cimage);
+}
+
+// 4x4 ordered dithering of a viewport, hand-written get_pixel loop against librif_image_dither
+static void bench_dither(const char *filename){
+    
+    RIF_CImage *cimage = librif_cimage_open(filename, NULL);
+    if(cimage == NULL){
+        return;
+    }
+    
+    librif_cimage_read(cimage, 0, NULL);
+    RIF_Image *image = librif_cimage_decompress(cimage, NULL);
+    
+    static const uint8_t bayer4[4][4] = {
+        { 8, 136, 40, 168 },
+        { 200, 72, 232, 104 },
+        { 56, 184, 24, 152 },
+        { 248, 120, 216, 88 }
+    };
+    
+    int width = 400;
+    int height = 240;
+    int frames = 200;
+    size_t stride = width / 8;
+    
+    uint8_t *framebuffer = malloc(stride * height);
+    unsigned int sum = 0;
+    
+    double start = bench_now();
+    for(int frame = 0; frame < frames; frame++){
+        int x0 = frame * 3 % image->width;
+        int y0 = frame * 2 % image->height;
+        for(int y = 0; y < height; y++){
+            uint8_t *row = &framebuffer[y * stride];
+            memset(row, 0, stride);
+            for(int x = 0; x < width; x++){
+                uint8_t color;
+                librif_image_get_pixel(image, x0 + x, y0 + y, &color, NULL);
+                if(color >= bayer4[(y0 + y) & 3][(x0 + x) & 3]){
+                    row[x >> 3] |= 0x80 >> (x & 7);
+                }
+            }
+        }
+        sum += framebuffer[frame];
+    }
+    double perPixelTime = (bench_now() - start) / frames;
+    
+    double times[3];
+    RIF_DitherMethod methods[3] = { RIF_DitherBayer4, RIF_DitherBayer8, RIF_DitherFloydSteinberg };
+    
+    for(int m = 0; m < 3; m++){
+        start = bench_now();
+        for(int frame = 0; frame < frames; frame++){
+            RIF_Rect rect = { frame * 3 % image->width, frame * 2 % image->height, width, height };
+            librif_image_dither(image, rect, methods[m], framebuffer, stride, NULL, 0);
+            sum += framebuffer[frame];
+        }
+        times[m] = (bench_now() - start) / frames;
+    }
+    
+    // compressed image, per-pixel thresholds against pre-dithered patterns
+    start = bench_now();
+    for(int frame = 0; frame < frames; frame++){
+        RIF_Rect rect = { frame * 3 % cimage->width, frame * 2 % cimage->height, width, height };
+        librif_cimage_dither(cimage, rect, RIF_DitherBayer4, framebuffer, stride, NULL, 0);
+        sum += framebuffer[frame];
+    }
+    double cimageTime = (bench_now() - start) / frames;
+    
+    start = bench_now();
+    bool dithered = librif_cimage_dither_patterns(cimage, RIF_DitherBayer4);
+    double patternsTime = bench_now() - start;
+    
+    start = bench_now();
+    for(int frame = 0; frame < frames; frame++){
+        RIF_Rect rect = { frame * 3 % cimage->width, frame * 2 % cimage->height, width, height };
+        librif_cimage_dither(cimage, rect, RIF_DitherBayer4, framebuffer, stride, NULL, 0);
+        sum += framebuffer[frame];
+    }
+    double cellsTime = (bench_now() - start) / frames;
+    
+    printf("  dither 400x240 get_pixel     %8.3f ms\n", perPixelTime * 1000);
+    printf("  dither 400x240 bayer4        %8.3f ms\n", times[0] * 1000);
+    printf("  dither 400x240 bayer8        %8.3f ms\n", times[1] * 1000);
+    printf("  dither 400x240 floyd         %8.3f ms\n", times[2] * 1000);
+    printf("  dither 400x240 cimage bayer4 %8.3f ms\n", cimageTime * 1000);
+    if(dithered){
+        printf("  dither %u patterns once      %8.3f ms\n", cimage->numberOfPatterns, patternsTime * 1000);
+        printf("  dither 400x240 cell blit     %8.3f ms\n", cellsTime * 1000);
+    }
+    printf("  (checksum %u)\n", sum);
+    
+    free(framebuffer);
+    librif_image_free(image);
+    librif_cimage_free(cimage);
+}
+
+// rotated and scaled frames, one affine row per scanline
+static void bench_affine(const char *filename){
+    
+    RIF_CImage *cimage = librif_cimage_open(filename, NULL);
+    if(cimage == NULL){
+        return;
+    }
+    
+    librif_cimage_read(cimage, 0, NULL);
+    RIF_Image *image = librif_cimage_decompress(cimage, NULL);
+    
+    int width = 400;
+    int height = 240;
+    int frames = 100;
+    
+    uint8_t *frame = malloc(width * height);
+    unsigned int sum = 0;
+    
+    double start = bench_now();
+    for(int f = 0; f < frames; f++){
+        float angle = f * 0.05f;
+        float du = cosf(angle) * 1.5f;
+        float dv = sinf(angle) * 1.5f;
+        for(int y = 0; y < height; y++){
+            float u = 512 - dv * y;
+            float v = 512 + du * y;
+            for(int x = 0; x < width; x++){
+                librif_cimage_get_pixel(cimage, (int)floorf(u + du * x), (int)floorf(v + dv * x), &frame[y * width + x], NULL);
+            }
+        }
+        sum += frame[f];
+    }
+    double perPixelTime = (bench_now() - start) / frames;
+    
+    double times[3];
+    
+    for(int m = 0; m < 3; m++){
+        start = bench_now();
+        for(int f = 0; f < frames; f++){
+            float angle = f * 0.05f;
+            int32_t du = (int32_t)(cosf(angle) * 1.5f * 65536);
+            int32_t dv = (int32_t)(sinf(angle) * 1.5f * 65536);
+            for(int y = 0; y < height; y++){
+                int32_t u = (512 << 16) - dv * y;
+                int32_t v = (512 << 16) + du * y;
+                uint8_t *row = &frame[y * width];
+                if(m == 0){
+                    librif_image_sample_affine_row(image, u, v, du, dv, width, RIF_WrapRepeat, RIF_FilterNearest, row, RIF_PixelFormatColor);
+                }
+                else {
+                    librif_cimage_sample_affine_row(cimage, u, v, du, dv, width, RIF_WrapRepeat, (m == 1) ? RIF_FilterNearest : RIF_FilterBilinear, row, RIF_PixelFormatColor);
+                }
+            }
+            sum += frame[f];
+        }
+        times[m] = (bench_now() - start) / frames;
+    }
+    
+    printf("  affine 400x240 get_pixel     %8.3f ms\n", perPixelTime * 1000);
+    printf("  affine 400x240 image nearest %8.3f ms\n", times[0] * 1000);
+    printf("  affine 400x240 cimage nearest%8.3f ms\n", times[1] * 1000);
+    printf("  affine 400x240 cimage bilin. %8.3f ms  (checksum %u)\n", times[2] * 1000, sum);
+    
+    free(frame);
+    librif_image_free(image);
+    librif_cimage_free(cimage);
+}
+
+// synthetic map made of numberOfPatterns random tiles
+static RIF_CImage* bench_synthetic_cimage(int size, unsigned int patternSize, unsigned int numberOfPatterns){
+    
+    RIF_Image *image = librif_image_new(size, size);
+    
+    size_t patternBytes = patternSize * patternSize * 2;
+    uint8_t *tiles = malloc(numberOfPatterns * patternBytes);
+    for(size_t i = 0; i < numberOfPatterns * patternBytes; i++){
+        tiles[i] = (i % 2) ? 255 : bench_random();
+    }
+    
+    for(int y = 0; y < size; y += patternSize){
+        for(int x = 0; x < size; x += patternSize){
+            uint8_t *tile = &tiles[(bench_random() % numberOfPatterns) * patternBytes];
+            for(unsigned int j = 0; j < patternSize; j++){
+                for(unsigned int i = 0; i < patternSize; i++){
+                    uint8_t *pixel = &tile[(j * patternSize + i) * 2];
+                    librif_image_set_pixel(image, x + i, y + j, pixel[0], pixel[1]);
+                }
+            }
+        }
+    }
+    
+    RIF_EncodeOptions options = { .patternMin = patternSize, .patternMax = patternSize, .patternStep = 1 };
+    RIF_CImage *cimage = librif_image_compress(image, &options);
+    
+    free(tiles);
+    librif_image_free(image);
+    
+    return cimage;
+}
+
+static inline uint32_t bench_pattern_index(RIF_CImage *cimage, int cell_i){
+    switch(cimage->cellIndexSize){
+        case 1:
+            return cimage->cells[cell_i];
+        case 2:
+            return ((uint16_t*)cimage->cells)[cell_i];
+        default:
+            return ((uint32_t*)cimage->cells)[cell_i];
+    }
+}
+
+// random access through a pointer per cell (the previous layout) and through compact indexes
+static void bench_cell_lookup(int size){
+    
+    RIF_CImage *cimage = bench_synthetic_cimage(size, 8, 4096);
+    
+    int patternSize = cimage->patternSize;
+    size_t patternBytes = patternSize * patternSize * 2;
+    
+    uint8_t **pointers = malloc(cimage->numberOfCells * sizeof(uint8_t*));
+    for(unsigned int i = 0; i < cimage->numberOfCells; i++){
+        pointers[i] = &cimage->patterns[bench_pattern_index(cimage, i) * patternBytes];
+    }
+    
+    int samples = 1 << 22;
+    int *coordinates = malloc(samples * 2 * sizeof(int));
+    for(int i = 0; i < samples * 2; i++){
+        coordinates[i] = bench_random() % size;
+    }
+    
+    unsigned int sum = 0;
+    
+    double start = bench_now();
+    for(int i = 0; i < samples; i++){
+        int x = coordinates[i * 2];
+        int y = coordinates[i * 2 + 1];
+        int cell_i = (y / patternSize) * cimage->cellCols + (x / patternSize);
+        sum += pointers[cell_i][((y % patternSize) * patternSize + (x % patternSize)) * 2];
+    }
+    double pointerTime = bench_now() - start;
+    
+    start = bench_now();
+    for(int i = 0; i < samples; i++){
+        int x = coordinates[i * 2];
+        int y = coordinates[i * 2 + 1];
+        int cell_i = (y / patternSize) * cimage->cellCols + (x / patternSize);
+        uint8_t *pattern = &cimage->patterns[bench_pattern_index(cimage, cell_i) * patternBytes];
+        sum += pattern[((y % patternSize) * patternSize + (x % patternSize)) * 2];
+    }
+    double indexTime = bench_now() - start;
+    
+    start = bench_now();
+    for(int i = 0; i < samples; i++){
+        uint8_t color;
+        librif_cimage_get_pixel_generic(cimage, coordinates[i * 2], coordinates[i * 2 + 1], &color, NULL);
+        sum += color;
+    }
+    double genericTime = bench_now() - start;
+    
+    start = bench_now();
+    for(int i = 0; i < samples; i++){
+        uint8_t color;
+        librif_cimage_get_pixel(cimage, coordinates[i * 2], coordinates[i * 2 + 1], &color, NULL);
+        sum += color;
+    }
+    double getPixelTime = bench_now() - start;
+    
+    RIF_CImageGetPixelFunction getPixel = cimage->getPixel;
+    
+    start = bench_now();
+    for(int i = 0; i < samples; i++){
+        uint8_t color;
+        getPixel(cimage, coordinates[i * 2], coordinates[i * 2 + 1], &color, NULL);
+        sum += color;
+    }
+    double accessorTime = bench_now() - start;
+    
+    printf("synthetic %dx%d, pattern %u, %u patterns, checksum %u\n", size, size, cimage->patternSize, cimage->numberOfPatterns, sum);
+    printf("  cells table  pointers %8zu KB, indexes %8zu KB\n", cimage->numberOfCells * sizeof(uint8_t*) / 1024, cimage->numberOfCells * (size_t)cimage->cellIndexSize / 1024);
+    printf("  random lookup pointer table  %8.1f M/s\n", samples / pointerTime / 1e6);
+    printf("  random lookup index table    %8.1f M/s\n", samples / indexTime / 1e6);
+    printf("  random get_pixel generic     %8.1f M/s\n", samples / genericTime / 1e6);
+    printf("  random get_pixel             %8.1f M/s\n", samples / getPixelTime / 1e6);
+    printf("  random getPixel accessor     %8.1f M/s\n", samples / accessorTime / 1e6);
+    
+    free(coordinates);
+    free(pointers);
+    librif_cimage_free(cimage);
+}
+
+// index decoding during a read against a raw fread of the same file, decoded cells must match the encoder's
+static bool bench_decode_cells(int size, unsigned int numberOfPatterns){
+    
+    RIF_CImage *source = bench_synthetic_cimage(size, 8, numberOfPatterns);
+    
+    char filename[64];
+    snprintf(filename, sizeof(filename), "synthetic-cells%u.rifc", source->cellIndexSize * 8);
+    if(!librif_cimage_write(source, filename)){
+        fprintf(stderr, "%s: can't write\n", filename);
+        librif_cimage_free(source);
+        return false;
+    }
+    
+    size_t fileSize = 0;
+    uint8_t *data = NULL;
+    double freadTime = 0, readTime = 0;
+    bool success = true;
+    
+    for(int run = 0; run < 5; run++){
+        double start = bench_now();
+        FILE *file = fopen(filename, "rb");
+        fseek(file, 0, SEEK_END);
+        fileSize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        data = malloc(fileSize);
+        size_t readSize = fread(data, 1, fileSize, file);
+        fclose(file);
+        double time = bench_now() - start;
+        free(data);
+        if(readSize != fileSize){
+            success = false;
+        }
+        if(run == 0 || time < freadTime){
+            freadTime = time;
+        }
+        
+        start = bench_now();
+        RIF_CImage *cimage = librif_cimage_open(filename, NULL);
+        bool readSuccess = (cimage != NULL) && librif_cimage_read(cimage, 0, NULL);
+        time = bench_now() - start;
+        if(run == 0 || time < readTime){
+            readTime = time;
+        }
+        
+        if(!readSuccess || cimage->cellIndexSize != source->cellIndexSize || memcmp(cimage->cells, source->cells, (size_t)source->numberOfCells * source->cellIndexSize) != 0){
+            success = false;
+        }
+        if(cimage != NULL){
+            librif_cimage_free(cimage);
+        }
+    }
+    
+    printf("synthetic %dx%d, %u patterns, %u-bit indexes, %zu KB\n", size, size, source->numberOfPatterns, source->cellIndexSize * 8, fileSize / 1024);
+    printf("  fread                       %8.3f ms\n", freadTime * 1000);
+    printf("  open + read, decoded        %8.3f ms  (%.2fx fread)\n", readTime * 1000, readTime / freadTime);
+    
+    if(!success){
+        fprintf(stderr, "%s: decoded cells don't match\n", filename);
+    }
+    
+    librif_cimage_free(source);
+    
+    return success;
+}
+
+// blocking open and read against a background load polled from the calling thread
+static void bench_async(const char *filename){
+    
+    double start = bench_now();
+    RIF_CImage *cimage = librif_cimage_open(filename, NULL);
+    if(cimage == NULL){
+        return;
+    }
+    librif_cimage_read(cimage, 0, NULL);
+    double syncTime = bench_now() - start;
+    librif_cimage_free(cimage);
+    
+    start = bench_now();
+    RIF_AsyncLoad *load = librif_cimage_open_async(filename, NULL, NULL, NULL);
+    double callTime = bench_now() - start;
+    
+    // polled once per simulated 100 us frame
+    int frames = 0;
+    while(librif_async_get_state(load) == RIF_AsyncLoading){
+        size_t readBytes, totalBytes;
+        librif_async_get_progress(load, &readBytes, &totalBytes);
+        usleep(100);
+        frames++;
+    }
+    double asyncTime = bench_now() - start;
+    
+    librif_async_free(load);
+    
+    printf("  open + read blocking        %8.3f ms\n", syncTime * 1000);
+    printf("  open_async call             %8.3f ms\n", callTime * 1000);
+    printf("  open_async until done       %8.3f ms  (%d frames)\n", asyncTime * 1000, frames);
+}
+
+// open + read from a file, a memory source through librif_io_memory and the zero-copy open
+static void bench_open_memory(const char *filename){
+    
+    FILE *file = fopen(filename, "rb");
+    if(file == NULL){
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    size_t readSize = fread(data, 1, size, file);
+    fclose(file);
+    
+    double fileTime = 0, ioTime = 0, memoryTime = 0;
+    
+    for(int run = 0; run < 5; run++){
+        double start = bench_now();
+        RIF_CImage *cimage = librif_cimage_open(filename, NULL);
+        librif_cimage_read(cimage, 0, NULL);
+        double time = bench_now() - start;
+        librif_cimage_free(cimage);
+        if(run == 0 || time < fileTime){
+            fileTime = time;
+        }
+        
+        start = bench_now();
+        cimage = librif_cimage_open_io(librif_io_memory(data, readSize), NULL);
+        librif_cimage_read(cimage, 0, NULL);
+        time = bench_now() - start;
+        librif_cimage_free(cimage);
+        if(run == 0 || time < ioTime){
+            ioTime = time;
+        }
+        
+        start = bench_now();
+        cimage = librif_cimage_open_memory(data, readSize);
+        time = bench_now() - start;
+        librif_cimage_free(cimage);
+        if(run == 0 || time < memoryTime){
+            memoryTime = time;
+        }
+    }
+    
+    free(data);
+    
+    printf("  open + read file            %8.3f ms\n", fileTime * 1000);
+    printf("  open_io + read memory       %8.3f ms\n", ioTime * 1000);
+    printf("  open_memory                 %8.3f ms\n", memoryTime * 1000);
+}
+
+// open + read + decompress against the single-pass open_decompressed, which never holds the cell table
+static bool bench_open_decompressed(const char *filename){
+    
+    double twoPassTime = 0, singlePassTime = 0;
+    size_t twoPassBytes = 0, singlePassBytes = 0;
+    bool success = true;
+    
+    // both sides take about a millisecond, a few runs are too noisy to compare
+    for(int run = 0; run < 20; run++){
+        double start = bench_now();
+        RIF_CImage *cimage = librif_cimage_open(filename, NULL);
+        if(cimage == NULL){
+            return true;
+        }
+        librif_cimage_read(cimage, 0, NULL);
+        RIF_Image *reference = librif_cimage_decompress(cimage, NULL);
+        double time = bench_now() - start;
+        if(run == 0 || time < twoPassTime){
+            twoPassTime = time;
+        }
+        
+        size_t patternsBytes = (size_t)cimage->numberOfPatterns * cimage->patternSize * cimage->patternSize * (cimage->hasAlpha ? 2 : 1);
+        size_t pixelsBytes = (size_t)reference->width * reference->height * (reference->hasAlpha ? 2 : 1);
+        twoPassBytes = patternsBytes + (size_t)cimage->numberOfCells * cimage->cellIndexSize + pixelsBytes;
+        singlePassBytes = patternsBytes + pixelsBytes;
+        
+        librif_cimage_free(cimage);
+        
+        start = bench_now();
+        RIF_Image *image = librif_cimage_open_decompressed(filename, NULL);
+        time = bench_now() - start;
+        if(run == 0 || time < singlePassTime){
+            singlePassTime = time;
+        }
+        
+        success &= (image != NULL && memcmp(image->pixels, reference->pixels, pixelsBytes) == 0);
+        
+        librif_image_free(reference);
+        if(image != NULL){
+            librif_image_free(image);
+        }
+    }
+    
+    printf("  open + read + decompress    %8.3f ms  (peak %zu KB)\n", twoPassTime * 1000, twoPassBytes / 1024);
+    printf("  open_decompressed           %8.3f ms  (peak %zu KB)%s\n", singlePassTime * 1000, singlePassBytes / 1024, success ? "" : "  MISMATCH");
+    
+    return success;
+}
+
+// budgeted read and decompress in simulated 2 ms frames, the longest frame should stay close to the budget
+static void bench_budget(const char *filename){
+    
+    const uint32_t budget = 2000;
+    
+    RIF_CImage *cimage = librif_cimage_open(filename, NULL);
+    if(cimage == NULL){
+        return;
+    }
+    
+    double start = bench_now();
+    double maxReadTime = 0;
+    int readFrames = 0;
+    
+    bool closed = false;
+    while(!closed){
+        double frameStart = bench_now();
+        librif_cimage_read_budget(cimage, budget, &closed);
+        double frameTime = bench_now() - frameStart;
+        if(frameTime > maxReadTime){
+            maxReadTime = frameTime;
+        }
+        readFrames++;
+    }
+    double readTime = bench_now() - start;
+    
+    start = bench_now();
+    double maxDecompressTime = 0;
+    int decompressFrames = 0;
+    
+    RIF_Image *image = librif_cimage_decompress_begin(cimage, NULL);
+    bool done = false;
+    while(!done){
+        double frameStart = bench_now();
+        librif_cimage_decompress_budget(cimage, image, budget, &done);
+        double frameTime = bench_now() - frameStart;
+        if(frameTime > maxDecompressTime){
+            maxDecompressTime = frameTime;
+        }
+        decompressFrames++;
+    }
+    double decompressTime = bench_now() - start;
+    
+    librif_image_free(image);
+    librif_cimage_free(cimage);
+    
+    printf("  read_budget 2 ms            %8.3f ms  (%d frames, max %.3f ms)\n", readTime * 1000, readFrames, maxReadTime * 1000);
+    printf("  decompress_budget 2 ms      %8.3f ms  (%d frames, max %.3f ms)\n", decompressTime * 1000, decompressFrames, maxDecompressTime * 1000);
+}
+
+// pooled open, chunked read and decompress, librif must not touch the heap
+static bool bench_pooled_load(const char *filename){
+    
+    size_t requiredSize = librif_pool_required_size(filename, true);
+    if(requiredSize == 0){
+        return true;
+    }
+    
+    // the first open only sizes the decompressed image
+    RIF_CImage *header = librif_cimage_open(filename, NULL);
+    size_t pixelsSize = (size_t)header->width * header->height * (header->hasAlpha ? 2 : 1);
+    librif_cimage_free(header);
+    
+    size_t decompressSize = sizeof(RIF_Image) + pixelsSize + 2 * RIF_POOL_ALIGNMENT;
+    RIF_Pool *pool = librif_pool_new(requiredSize + decompressSize);
+    
+    size_t allocations = librif_allocation_count();
+    double start = bench_now();
+    
+    RIF_CImage *cimage = librif_cimage_open(filename, pool);
+    bool closed = false;
+    while(cimage != NULL && !closed){
+        librif_cimage_read(cimage, 4096, &closed);
+    }
+    RIF_Image *image = (cimage != NULL) ? librif_cimage_decompress(cimage, pool) : NULL;
+    
+    double time = bench_now() - start;
+    allocations = librif_allocation_count() - allocations;
+    
+    bool success = (cimage != NULL && image != NULL && allocations == 0);
+    
+    printf("  pooled open + read + decompress %6.3f ms  (%zu allocations, pool %zu KB)%s\n", time * 1000, allocations, (requiredSize + decompressSize) / 1024, success ? "" : "  FAILED");
+    
+    if(image != NULL){
+        librif_image_free(image);
+    }
+    if(cimage != NULL){
+        librif_cimage_free(cimage);
+    }
+    librif_pool_free(pool);
+    
+    return success;
+}
+
+// concurrent loads, every worker opens and decompresses images until the jobs run out
+
+#define BENCH_STRESS_JOBS 256
+#define BENCH_STRESS_THREADS 8
+
+typedef struct {
+    const char **filenames;
+    int numberOfFiles;
+    // file contents, for the open_io jobs
+    uint8_t **data;
+    size_t *sizes;
+    // checksums of a single-threaded load
+    uint32_t *references;
+    // fully read, shared by all workers for get_pixel
+    RIF_CImage *shared;
+    uint32_t sharedReference;
+    int nextJob;
+    int failures;
+} BenchStress;
+
+static uint32_t bench_checksum(RIF_Image *image){
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    size_t size = (size_t)image->width * image->height * (image->hasAlpha ? 2 : 1);
+    for(size_t i = 0; i < size; i++){
+        hash = (hash ^ image->pixels[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t bench_shared_checksum(RIF_CImage *cimage){
+    uint32_t hash = 2166136261u;
+    for(int y = 0; y < cimage->height; y += 7){
+        for(int x = 0; x < cimage->width; x += 7){
+            uint8_t color, alpha;
+            librif_cimage_get_pixel(cimage, x, y, &color, &alpha);
+            hash = (hash ^ color ^ (alpha << 8)) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+static uint32_t bench_stress_load(BenchStress *stress, int job){
+    
+    int file_i = job % stress->numberOfFiles;
+    
+    RIF_CImage *cimage;
+    if((job / stress->numberOfFiles) % 2 == 0){
+        cimage = librif_cimage_open(stress->filenames[file_i], NULL);
+    }
+    else {
+        cimage = librif_cimage_open_io(librif_io_memory(stress->data[file_i], stress->sizes[file_i]), NULL);
+    }
+    if(cimage == NULL){
+        return 0;
+    }
+    
+    bool closed = false;
+    while(!closed && librif_cimage_read(cimage, 4096, &closed));
+    
+    RIF_Image *image = librif_cimage_decompress(cimage, NULL);
+    uint32_t checksum = bench_checksum(image);
+    
+    librif_image_free(image);
+    librif_cimage_free(cimage);
+    
+    return checksum;
+}
+
+static void* bench_stress_worker(void *arg){
+    BenchStress *stress = arg;
+    
+    while(1){
+        int job = __atomic_fetch_add(&stress->nextJob, 1, __ATOMIC_RELAXED);
+        if(job >= BENCH_STRESS_JOBS){
+            break;
+        }
+        
+        bool success = (bench_stress_load(stress, job) == stress->references[job % stress->numberOfFiles]);
+        // readers on one fully read image
+        success &= (bench_shared_checksum(stress->shared) == stress->sharedReference);
+        
+        if(!success){
+            __atomic_fetch_add(&stress->failures, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+static bool bench_stress(const char **filenames, int numberOfFiles){
+    
+    BenchStress stress;
+    stress.filenames = filenames;
+    stress.numberOfFiles = numberOfFiles;
+    stress.data = malloc(numberOfFiles * sizeof(uint8_t*));
+    stress.sizes = malloc(numberOfFiles * sizeof(size_t));
+    stress.references = malloc(numberOfFiles * sizeof(uint32_t));
+    stress.nextJob = 0;
+    stress.failures = 0;
+    
+    for(int i = 0; i < numberOfFiles; i++){
+        stress.data[i] = NULL;
+        stress.sizes[i] = 0;
+        
+        FILE *file = fopen(filenames[i], "rb");
+        if(file != NULL){
+            fseek(file, 0, SEEK_END);
+            stress.sizes[i] = ftell(file);
+            fseek(file, 0, SEEK_SET);
+            stress.data[i] = malloc(stress.sizes[i]);
+            stress.sizes[i] = fread(stress.data[i], 1, stress.sizes[i], file);
+            fclose(file);
+        }
+        
+        stress.references[i] = bench_stress_load(&stress, i);
+    }
+    
+    stress.shared = librif_cimage_open(filenames[0], NULL);
+    if(stress.shared == NULL){
+        return true;
+    }
+    librif_cimage_read(stress.shared, 0, NULL);
+    stress.sharedReference = bench_shared_checksum(stress.shared);
+    
+    double start = bench_now();
+    
+    pthread_t threads[BENCH_STRESS_THREADS];
+    for(int i = 0; i < BENCH_STRESS_THREADS; i++){
+        pthread_create(&threads[i], NULL, bench_stress_worker, &stress);
+    }
+    for(int i = 0; i < BENCH_STRESS_THREADS; i++){
+        pthread_join(threads[i], NULL);
+    }
+    
+    double time = bench_now() - start;
+    
+    printf("stress %d loads, %d threads\n", BENCH_STRESS_JOBS, BENCH_STRESS_THREADS);
+    printf("  open + read + decompress    %8.3f ms  (%d mismatches)%s\n", time * 1000, stress.failures, stress.failures == 0 ? "" : "  FAILED");
+    
+    librif_cimage_free(stress.shared);
+    for(int i = 0; i < numberOfFiles; i++){
+        free(stress.data[i]);
+    }
+    free(stress.data);
+    free(stress.sizes);
+    free(stress.references);
+    
+    return stress.failures == 0;
+}
+
+// random get_pixel on a cache-resident image, general path against the accessors chosen at open
+static void bench_get_pixel(unsigned int patternSize, bool alpha){
+    
+    int size = 240;
+    
+    RIF_CImage *cimage = bench_synthetic_cimage(size, patternSize, 64);
+    RIF_Image *image = librif_cimage_decompress(cimage, NULL);
+    
+    if(!alpha){
+        // same pixels without the alpha channel
+        RIF_Image *opaque = librif_image_new(size, size);
+        opaque->hasAlpha = false;
+        for(int y = 0; y < size; y++){
+            for(int x = 0; x < size; x++){
+                uint8_t color, pixelAlpha;
+                librif_image_get_pixel(image, x, y, &color, &pixelAlpha);
+                opaque->pixels[y * size + x] = color;
+            }
+        }
+        librif_image_free(image);
+        librif_cimage_free(cimage);
+        
+        RIF_EncodeOptions options = { .patternMin = patternSize, .patternMax = patternSize, .patternStep = 1 };
+        cimage = librif_image_compress(opaque, &options);
+        image = librif_image_copy(opaque);
+        librif_image_free(opaque);
+    }
+    
+    int samples = 1 << 14;
+    int rounds = 64;
+    int *coordinates = malloc(samples * 2 * sizeof(int));
+    for(int i = 0; i < samples * 2; i++){
+        coordinates[i] = bench_random() % size;
+    }
+    
+    unsigned int sum = 0;
+    double times[4];
+    
+    RIF_CImageGetPixelFunction cimageFunctions[2] = { librif_cimage_get_pixel_generic, cimage->getPixel };
+    RIF_ImageGetPixelFunction imageFunctions[2] = { librif_image_get_pixel_generic, image->getPixel };
+    
+    for(int k = 0; k < 2; k++){
+        RIF_CImageGetPixelFunction getPixel = cimageFunctions[k];
+        times[k] = 0;
+        // best of a few runs, single calls are short enough to be skewed by other processes
+        for(int run = 0; run < 5; run++){
+            double start = bench_now();
+            for(int round = 0; round < rounds; round++){
+                for(int i = 0; i < samples; i++){
+                    uint8_t color, pixelAlpha;
+                    getPixel(cimage, coordinates[i * 2], coordinates[i * 2 + 1], &color, &pixelAlpha);
+                    sum += color + pixelAlpha;
+                }
+            }
+            double time = bench_now() - start;
+            if(run == 0 || time < times[k]){
+                times[k] = time;
+            }
+        }
+    }
+    
+    for(int k = 0; k < 2; k++){
+        RIF_ImageGetPixelFunction getPixel = imageFunctions[k];
+        times[2 + k] = 0;
+        // best of a few runs, single calls are short enough to be skewed by other processes
+        for(int run = 0; run < 5; run++){
+            double start = bench_now();
+            for(int round = 0; round < rounds; round++){
+                for(int i = 0; i < samples; i++){
+                    uint8_t color, pixelAlpha;
+                    getPixel(image, coordinates[i * 2], coordinates[i * 2 + 1], &color, &pixelAlpha);
+                    sum += color + pixelAlpha;
+                }
+            }
+            double time = bench_now() - start;
+            if(run == 0 || time < times[2 + k]){
+                times[2 + k] = time;
+            }
+        }
+    }
+    
+    double count = (double)samples * rounds;
+    
+    printf("get_pixel %dx%d, pattern %u, %s, checksum %u\n", size, size, cimage->patternSize, alpha ? "alpha" : "no alpha", sum);
+    printf("  cimage generic               %8.1f M/s\n", count / times[0] / 1e6);
+    printf("  cimage accessor              %8.1f M/s\n", count / times[1] / 1e6);
+    printf("  image generic                %8.1f M/s\n", count / times[2] / 1e6);
+    printf("  image accessor               %8.1f M/s\n", count / times[3] / 1e6);
+    
+    free(coordinates);
+    librif_image_free(image);
+    librif_cimage_free(cimage);
+}
+
+// JSON suite, see bench/Makefile
+
+static const char *suiteFilenames[] = {
+    "../images/track-512",
+    "../images/track-1024"
+};
+
+static const int suiteSyntheticSizes[] = { 2048, 4096, 8192 };
+
+static const size_t suiteChunkSizes[] = { 4096, 65536, 1048576 };
+
+#define BENCH_SUITE_CHUNKS (sizeof(suiteChunkSizes) / sizeof(suiteChunkSizes[0]))
+
+// get_pixel calls per measure, sequential scans stop after this many pixels too
+#define BENCH_SUITE_PIXELS (1 << 24)
+
+typedef struct {
+    double openImage;
+    double openCImage;
+    double readImage[BENCH_SUITE_CHUNKS + 1];
+    double readCImage[BENCH_SUITE_CHUNKS + 1];
+    double sequentialImage;
+    double randomImage;
+    double sequentialCImage;
+    double randomCImage;
+    double decompress;
+} BenchSuiteResult;
+
+static uint32_t bench_hash(uint32_t x, uint32_t y){
+    uint32_t h = x * 73856093u ^ y * 19349663u;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    return h ^ (h >> 15);
+}
+
+// a tile map: 8x8 tiles out of 64, grouped in 4x4 tile areas like a level made with a tile editor
+static bool bench_write_synthetic(const char *name, int size){
+    
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s.rifc", name);
+    
+    FILE *file = fopen(filename, "rb");
+    if(file != NULL){
+        fclose(file);
+        return true;
+    }
+    
+    // raw file without alpha, compressed through librif_image_open_memory
+    size_t dataSize = 9 + (size_t)size * size;
+    uint8_t *data = malloc(dataSize);
+    
+    data[0] = 0;
+    for(int i = 0; i < 4; i++){
+        data[1 + i] = (uint8_t)(size >> (24 - i * 8));
+        data[5 + i] = (uint8_t)(size >> (24 - i * 8));
+    }
+    
+    uint8_t *pixels = &data[9];
+    for(int y = 0; y < size; y++){
+        for(int x = 0; x < size; x++){
+            uint32_t tile = bench_hash(x / 32, y / 32) % 16 * 4 + bench_hash(x / 8, y / 8) % 4;
+            pixels[(size_t)y * size + x] = (uint8_t)(bench_hash(tile, (y % 8) * 8 + x % 8) % 4 * 85);
+        }
+    }
+    
+    snprintf(filename, sizeof(filename), "%s.rif", name);
+    file = fopen(filename, "wb");
+    if(file == NULL){
+        free(data);
+        return false;
+    }
+    fwrite(data, 1, dataSize, file);
+    fclose(file);
+    
+    RIF_Image *image = librif_image_open_memory(data, dataSize);
+    
+    RIF_EncodeOptions options = { .patternMin = 8, .patternMax = 8, .patternStep = 2 };
+    RIF_CImage *cimage = librif_image_compress(image, &options);
+    librif_image_free(image);
+    free(data);
+    
+    if(cimage == NULL){
+        return false;
+    }
+    
+    // written last, its presence marks a complete pair
+    snprintf(filename, sizeof(filename), "%s.rifc", name);
+    bool success = librif_cimage_write(cimage, filename);
+    librif_cimage_free(cimage);
+    
+    return success;
+}
+
+static double bench_min(double a, double b){
+    return (a < b) ? a : b;
+}
+
+static void bench_suite_read(const char *filename, bool compressed, int runs, double *results){
+    
+    for(int chunk_i = 0; chunk_i <= BENCH_SUITE_CHUNKS; chunk_i++){
+        // 0 reads the entire file
+        size_t chunkSize = (chunk_i == 0) ? 0 : suiteChunkSizes[chunk_i - 1];
+        double best = INFINITY;
+        size_t totalBytes = 0;
+        
+        for(int run = 0; run < runs; run++){
+            bool closed = false;
+            double start;
+            
+            if(compressed){
+                RIF_CImage *cimage = librif_cimage_open(filename, NULL);
+                start = bench_now();
+                while(!closed && librif_cimage_read(cimage, chunkSize, &closed));
+                best = bench_min(best, bench_now() - start);
+                totalBytes = cimage->totalBytes;
+                librif_cimage_free(cimage);
+            }
+            else {
+                RIF_Image *image = librif_image_open(filename, NULL);
+                start = bench_now();
+                while(!closed && librif_image_read(image, chunkSize, &closed));
+                best = bench_min(best, bench_now() - start);
+                totalBytes = image->totalBytes;
+                librif_image_free(image);
+            }
+        }
+        
+        results[chunk_i] = totalBytes / 1e6 / best;
+    }
+}
+
+static double bench_suite_get_pixel(RIF_Image *image, RIF_CImage *cimage, bool random, int runs){
+    
+    int width = image ? image->width : cimage->width;
+    int height = image ? image->height : cimage->height;
+    
+    size_t count = (size_t)width * height;
+    if(count > BENCH_SUITE_PIXELS){
+        count = BENCH_SUITE_PIXELS;
+    }
+    
+    double best = INFINITY;
+    uint32_t checksum = 0;
+    
+    for(int run = 0; run < runs; run++){
+        bench_random_state = 1;
+        double start = bench_now();
+        
+        for(size_t i = 0; i < count; i++){
+            int x, y;
+            if(random){
+                x = bench_random() % width;
+                y = bench_random() % height;
+            }
+            else {
+                x = i % width;
+                y = (int)(i / width);
+            }
+            
+            uint8_t color, alpha;
+            if(image != NULL){
+                librif_image_get_pixel(image, x, y, &color, &alpha);
+            }
+            else {
+                librif_cimage_get_pixel(cimage, x, y, &color, &alpha);
+            }
+            checksum += color;
+        }
+        
+        best = bench_min(best, bench_now() - start);
+    }
+    
+    // keeps the loop from being optimized out
+    if(checksum == 1){
+        fprintf(stderr, " ");
+    }
+    
+    return count / 1e6 / best;
+}
+
+static bool bench_suite_run(const char *name, BenchSuiteResult *result, int *width, int *height){
+    
+    char rifFilename[256], rifcFilename[256];
+    snprintf(rifFilename, sizeof(rifFilename), "%s.rif", name);
+    snprintf(rifcFilename, sizeof(rifcFilename), "%s.rifc", name);
+    
+    RIF_Image *image = librif_image_open(rifFilename, NULL);
+    RIF_CImage *cimage = librif_cimage_open(rifcFilename, NULL);
+    if(image == NULL || cimage == NULL){
+        if(image != NULL){
+            librif_image_free(image);
+        }
+        if(cimage != NULL){
+            librif_cimage_free(cimage);
+        }
+        return false;
+    }
+    
+    librif_image_read(image, 0, NULL);
+    librif_cimage_read(cimage, 0, NULL);
+    
+    *width = image->width;
+    *height = image->height;
+    
+    // fewer runs on the large maps
+    int runs = ((size_t)image->width * image->height > (1 << 22)) ? 2 : 5;
+    
+    result->openImage = INFINITY;
+    result->openCImage = INFINITY;
+    for(int run = 0; run < runs * 4; run++){
+        double start = bench_now();
+        RIF_Image *opened = librif_image_open(rifFilename, NULL);
+        result->openImage = bench_min(result->openImage, bench_now() - start);
+        librif_image_free(opened);
+        
+        start = bench_now();
+        RIF_CImage *copened = librif_cimage_open(rifcFilename, NULL);
+        result->openCImage = bench_min(result->openCImage, bench_now() - start);
+        librif_cimage_free(copened);
+    }
+    
+    bench_suite_read(rifFilename, false, runs, result->readImage);
+    bench_suite_read(rifcFilename, true, runs, result->readCImage);
+    
+    result->sequentialImage = bench_suite_get_pixel(image, NULL, false, runs);
+    result->randomImage = bench_suite_get_pixel(image, NULL, true, runs);
+    result->sequentialCImage = bench_suite_get_pixel(NULL, cimage, false, runs);
+    result->randomCImage = bench_suite_get_pixel(NULL, cimage, true, runs);
+    
+    double best = INFINITY;
+    for(int run = 0; run < runs; run++){
+        double start = bench_now();
+        RIF_Image *decompressed = librif_cimage_decompress(cimage, NULL);
+        best = bench_min(best, bench_now() - start);
+        librif_image_free(decompressed);
+    }
+    size_t pixelsSize = (size_t)image->width * image->height * (image->hasAlpha ? 2 : 1);
+    result->decompress = pixelsSize / 1e6 / best;
+    
+    librif_image_free(image);
+    librif_cimage_free(cimage);
+    
+    return true;
+}
+
+static void bench_suite_print_reads(const char *key, const double *results){
+    printf("        \"%s\": { \"full\": %.1f", key, results[0]);
+    for(int i = 0; i < BENCH_SUITE_CHUNKS; i++){
+        printf(", \"%zu\": %.1f", suiteChunkSizes[i], results[i + 1]);
+    }
+    printf(" }");
+}
+
+// names are paths without the .rif/.rifc extension
+static void bench_suite(const char **names, int numberOfNames){
+    
+    printf("{\n  \"librif_bench\": 1,\n  \"units\": { \"open\": \"us\", \"read\": \"MB/s\", \"get_pixel\": \"Mpx/s\", \"decompress\": \"MB/s\" },\n  \"images\": [");
+    
+    bool first = true;
+    for(int i = 0; i < numberOfNames; i++){
+        BenchSuiteResult result;
+        int width, height;
+        
+        if(!bench_suite_run(names[i], &result, &width, &height)){
+            fprintf(stderr, "%s: can't open\n", names[i]);
+            continue;
+        }
+        
+        const char *name = strrchr(names[i], '/');
+        name = (name != NULL) ? name + 1 : names[i];
+        
+        printf("%s\n    {\n", first ? "" : ",");
+        printf("      \"name\": \"%s\", \"width\": %d, \"height\": %d,\n", name, width, height);
+        printf("      \"open\": { \"image\": %.1f, \"cimage\": %.1f },\n", result.openImage * 1e6, result.openCImage * 1e6);
+        printf("      \"read\": {\n");
+        bench_suite_print_reads("image", result.readImage);
+        printf(",\n");
+        bench_suite_print_reads("cimage", result.readCImage);
+        printf("\n      },\n");
+        printf("      \"get_pixel\": {\n");
+        printf("        \"image\": { \"sequential\": %.1f, \"random\": %.1f },\n", result.sequentialImage, result.randomImage);
+        printf("        \"cimage\": { \"sequential\": %.1f, \"random\": %.1f }\n", result.sequentialCImage, result.randomCImage);
+        printf("      },\n");
+        printf("      \"decompress\": %.1f\n    }", result.decompress);
+        fflush(stdout);
+        
+        first = false;
+    }
+    
+    printf("\n  ]\n}\n");
+}
+
+//
+// Checks, every fast path is compared with the generic get_pixel of the same image
+//
+
+typedef struct {
+    int width;
+    int height;
+    bool alpha;
+    unsigned int patternSize;
+} BenchCheckImage;
+
+// odd sizes leave partial cells on the edges, 64x32 keeps the power-of-two sampling paths
+static const BenchCheckImage checkImages[] = {
+    { 203, 77, true, 8 },
+    { 64, 32, false, 6 },
+    { 64, 32, true, 4 }
+};
+
+static const RIF_PixelFormat checkFormats[] = { RIF_PixelFormatColor, RIF_PixelFormatColorAlpha };
+
+// raw file bytes, 8x8 tiles out of 16 so the encoder finds repeated patterns
+static uint8_t* bench_check_raw_data(const BenchCheckImage *check, size_t *size){
+    
+    size_t pixelSize = check->alpha ? 2 : 1;
+    *size = 9 + (size_t)check->width * check->height * pixelSize;
+    
+    uint8_t *data = malloc(*size);
+    
+    data[0] = check->alpha ? 1 : 0;
+    for(int i = 0; i < 4; i++){
+        data[1 + i] = (uint8_t)(check->width >> (24 - i * 8));
+        data[5 + i] = (uint8_t)(check->height >> (24 - i * 8));
+    }
+    
+    static const uint8_t alphas[] = { 0, 127, 128, 255 };
+    
+    uint8_t *pixels = &data[9];
+    for(int y = 0; y < check->height; y++){
+        for(int x = 0; x < check->width; x++){
+            uint32_t tile = bench_hash(x / 8, y / 8) % 16;
+            uint32_t hash = bench_hash(tile, (y % 8) * 8 + x % 8);
+            uint8_t *pixel = &pixels[((size_t)y * check->width + x) * pixelSize];
+            pixel[0] = (uint8_t)hash;
+            if(check->alpha){
+                pixel[1] = alphas[(hash >> 8) % 4];
+            }
+        }
+    }
+    
+    return data;
+}
+
+static void bench_check_get_pixel(RIF_Image *image, RIF_CImage *cimage, int x, int y, uint8_t *color, uint8_t *alpha){
+    if(image != NULL){
+        librif_image_get_pixel_generic(image, x, y, color, alpha);
+    }
+    else {
+        librif_cimage_get_pixel_generic(cimage, x, y, color, alpha);
+    }
+}
+
+// count pixels at (x0, y) against get_pixel, stepping one pixel at a time
+static bool bench_check_row(RIF_Image *image, RIF_CImage *cimage, int x0, int y, int count, const uint8_t *row, RIF_PixelFormat format){
+    
+    for(int i = 0; i < count; i++){
+        uint8_t color, alpha;
+        bench_check_get_pixel(image, cimage, x0 + i, y, &color, &alpha);
+        
+        if(format == RIF_PixelFormatColorAlpha){
+            if(row[i * 2] != color || row[i * 2 + 1] != alpha){
+                return false;
+            }
+        }
+        else if(row[i] != color){
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// rects inside, across every edge and outside the image
+static int bench_check_rects(int width, int height, RIF_Rect *rects){
+    
+    RIF_Rect list[] = {
+        { 0, 0, width, height },
+        { -5, -3, width / 2 + 7, height / 2 + 5 },
+        { width - 3, height - 2, 11, 9 },
+        { -9, -9, width + 18, height + 18 },
+        { 3, 1, 1, 1 },
+        { -20, -20, 8, 8 },
+        { width + 4, 5, 13, 3 }
+    };
+    
+    int count = sizeof(list) / sizeof(list[0]);
+    memcpy(rects, list, sizeof(list));
+    
+    return count;
+}
+
+static bool bench_check_copy_rect(RIF_Image *image, RIF_CImage *cimage){
+    
+    int width = (image != NULL) ? image->width : cimage->width;
+    int height = (image != NULL) ? image->height : cimage->height;
+    
+    RIF_Rect rects[8];
+    int numberOfRects = bench_check_rects(width, height, rects);
+    
+    bool success = true;
+    
+    for(int f = 0; f < 2; f++){
+        for(int r = 0; r < numberOfRects; r++){
+            RIF_Rect rect = rects[r];
+            
+            // rows are padded to check that the stride is used
+            size_t stride = rect.width * 2 + 3;
+            uint8_t *buffer = malloc(stride * rect.height);
+            
+            if(image != NULL){
+                librif_image_copy_rect(image, rect.x, rect.y, rect.width, rect.height, buffer, stride, checkFormats[f]);
+            }
+            else {
+                librif_cimage_copy_rect(cimage, rect.x, rect.y, rect.width, rect.height, buffer, stride, checkFormats[f]);
+            }
+            
+            for(int j = 0; j < rect.height; j++){
+                success &= bench_check_row(image, cimage, rect.x, rect.y + j, rect.width, &buffer[j * stride], checkFormats[f]);
+            }
+            
+            free(buffer);
+        }
+    }
+    
+    return success;
+}
+
+// allocated and caller-storage cursors, rows starting above the image and wider than RIF_ROW_SEGMENTS cells
+static bool bench_check_row_cursors(RIF_CImage *cimage){
+    
+    int spans[][3] = {
+        { -3, -5, cimage->width + 4 },
+        { 0, 0, cimage->width },
+        { cimage->height / 2, 7, 8 },
+        { 2, -600, 600 },
+        { cimage->height - 1, cimage->width - 2, cimage->width + 30 }
+    };
+    
+    bool success = true;
+    
+    for(int f = 0; f < 2; f++){
+        for(int s = 0; s < sizeof(spans) / sizeof(spans[0]); s++){
+            int y = spans[s][0];
+            int x0 = spans[s][1];
+            int x1 = spans[s][2];
+            
+            uint8_t *buffer = malloc((x1 - x0) * 2);
+            
+            RIF_CImageRow storage;
+            RIF_CImageRow *row = &storage;
+            
+            if(s % 2 == 0){
+                row = librif_cimage_row_begin(cimage, y, x0, x1, checkFormats[f]);
+            }
+            else if(!librif_cimage_row_init(&storage, cimage, y, x0, x1, checkFormats[f])){
+                row = NULL;
+            }
+            
+            if(row == NULL){
+                free(buffer);
+                success = false;
+                continue;
+            }
+            
+            int rows = 0;
+            while(librif_cimage_row_next(row, buffer)){
+                success &= bench_check_row(NULL, cimage, x0, y + rows, x1 - x0, buffer, checkFormats[f]);
+                rows++;
+            }
+            
+            // one row per image row from y to the bottom
+            success &= (rows == cimage->height - y);
+            
+            if(s % 2 == 0){
+                librif_cimage_row_free(row);
+            }
+            else {
+                librif_cimage_row_release(row);
+            }
+            
+            free(buffer);
+        }
+    }
+    
+    return success;
+}
+
+// Bayer matrix built by the recursive definition, M(2n) = 4 M(n) + M(2) for each quadrant
+static uint8_t bench_check_bayer_threshold(int x, int y, int matrixSize){
+    
+    static const int bayer2[2][2] = { { 0, 2 }, { 3, 1 } };
+    
+    int value = 0;
+    for(int n = matrixSize / 2; n > 0; n /= 2){
+        value = value * 4 + bayer2[(y / n) % 2][(x / n) % 2];
+    }
+    
+    // reverse the digit order, the quadrant of the whole matrix is the least significant one
+    int reversed = 0;
+    for(int n = matrixSize / 2; n > 0; n /= 2){
+        reversed = reversed * 4 + value % 4;
+        value /= 4;
+    }
+    
+    return (reversed * 256 + 128) / (matrixSize * matrixSize);
+}
+
+// one bit per pixel from get_pixel, error diffusion restarts at the edges of the rect
+static void bench_check_dither_reference(RIF_Image *image, RIF_CImage *cimage, RIF_Rect rect, RIF_DitherMethod method, uint8_t *dst, size_t dstStride, uint8_t *mask){
+    
+    int matrixSize = 0;
+    switch(method){
+        case RIF_DitherThreshold:
+            matrixSize = 1;
+            break;
+        case RIF_DitherBayer2:
+            matrixSize = 2;
+            break;
+        case RIF_DitherBayer4:
+            matrixSize = 4;
+            break;
+        case RIF_DitherBayer8:
+            matrixSize = 8;
+            break;
+        default:
+            break;
+    }
+    
+    // two columns of padding on both sides, two rows below
+    int errorStride = rect.width + 4;
+    int *errors = calloc((size_t)errorStride * (rect.height + 2), sizeof(int));
+    
+    memset(dst, 0, dstStride * rect.height);
+    memset(mask, 0, dstStride * rect.height);
+    
+    for(int j = 0; j < rect.height; j++){
+        for(int i = 0; i < rect.width; i++){
+            int x = rect.x + i;
+            int y = rect.y + j;
+            
+            uint8_t color, alpha;
+            bench_check_get_pixel(image, cimage, x, y, &color, &alpha);
+            
+            bool white;
+            if(matrixSize > 0){
+                int matrixX = ((x % matrixSize) + matrixSize) % matrixSize;
+                int matrixY = ((y % matrixSize) + matrixSize) % matrixSize;
+                white = color >= bench_check_bayer_threshold(matrixX, matrixY, matrixSize);
+            }
+            else {
+                int *error = &errors[j * errorStride + i + 2];
+                int value = color + *error;
+                white = value >= 128;
+                int e = value - (white ? 255 : 0);
+                
+                if(method == RIF_DitherFloydSteinberg){
+                    int right = e * 7 / 16;
+                    int downLeft = e * 3 / 16;
+                    int down = e * 5 / 16;
+                    error[1] += right;
+                    error[errorStride - 1] += downLeft;
+                    error[errorStride] += down;
+                    error[errorStride + 1] += e - right - downLeft - down;
+                }
+                else {
+                    int part = e / 8;
+                    error[1] += part;
+                    error[2] += part;
+                    error[errorStride - 1] += part;
+                    error[errorStride] += part;
+                    error[errorStride + 1] += part;
+                    error[errorStride * 2] += part;
+                }
+            }
+            
+            if(white){
+                dst[j * dstStride + (i >> 3)] |= 0x80 >> (i & 7);
+            }
+            if(alpha >= 128){
+                mask[j * dstStride + (i >> 3)] |= 0x80 >> (i & 7);
+            }
+        }
+    }
+    
+    free(errors);
+}
+
+static bool bench_check_bits(const uint8_t *a, const uint8_t *b, size_t stride, int width, int height){
+    for(int j = 0; j < height; j++){
+        for(int i = 0; i < width; i++){
+            int bit = 0x80 >> (i & 7);
+            if((a[j * stride + (i >> 3)] & bit) != (b[j * stride + (i >> 3)] & bit)){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// every method, then the pre-dithered patterns of a cimage for the methods that allow them
+static bool bench_check_dither(RIF_Image *image, RIF_CImage *cimage){
+    
+    int width = (image != NULL) ? image->width : cimage->width;
+    int height = (image != NULL) ? image->height : cimage->height;
+    
+    RIF_Rect rects[8];
+    int numberOfRects = bench_check_rects(width, height, rects);
+    
+    RIF_DitherMethod methods[] = { RIF_DitherThreshold, RIF_DitherBayer2, RIF_DitherBayer4, RIF_DitherBayer8, RIF_DitherFloydSteinberg, RIF_DitherAtkinson };
+    int numberOfMethods = sizeof(methods) / sizeof(methods[0]);
+    
+    bool success = true;
+    
+    for(int pass = 0; pass < ((cimage != NULL) ? 2 : 1); pass++){
+        for(int m = 0; m < numberOfMethods; m++){
+            if(pass == 1 && !librif_cimage_dither_patterns(cimage, methods[m])){
+                continue;
+            }
+            
+            for(int r = 0; r < numberOfRects; r++){
+                RIF_Rect rect = rects[r];
+                
+                size_t stride = (rect.width + 7) / 8 + 1;
+                size_t size = stride * rect.height;
+                
+                uint8_t *dst = malloc(size);
+                uint8_t *mask = malloc(size);
+                uint8_t *expectedDst = malloc(size);
+                uint8_t *expectedMask = malloc(size);
+                
+                bool dithered;
+                if(image != NULL){
+                    dithered = librif_image_dither(image, rect, methods[m], dst, stride, mask, stride);
+                }
+                else {
+                    dithered = librif_cimage_dither(cimage, rect, methods[m], dst, stride, mask, stride);
+                }
+                
+                bench_check_dither_reference(image, cimage, rect, methods[m], expectedDst, stride, expectedMask);
+                
+                success &= dithered;
+                success &= bench_check_bits(dst, expectedDst, stride, rect.width, rect.height);
+                success &= bench_check_bits(mask, expectedMask, stride, rect.width, rect.height);
+                
+                free(dst);
+                free(mask);
+                free(expectedDst);
+                free(expectedMask);
+            }
+        }
+    }
+    
+    return success;
+}
+
+static bool bench_check_wrap(int *x, int size, RIF_WrapMode wrapMode){
+    if(*x >= 0 && *x < size){
+        return true;
+    }
+    if(wrapMode == RIF_WrapClamp){
+        *x = (*x < 0) ? 0 : size - 1;
+        return true;
+    }
+    if(wrapMode == RIF_WrapRepeat){
+        *x = ((*x % size) + size) % size;
+        return true;
+    }
+    return false;
+}
+
+// filled samples are black and opaque
+static void bench_check_sample(RIF_Image *image, RIF_CImage *cimage, int x, int y, RIF_WrapMode wrapMode, uint8_t *color, uint8_t *alpha){
+    
+    int width = (image != NULL) ? image->width : cimage->width;
+    int height = (image != NULL) ? image->height : cimage->height;
+    
+    *color = 0;
+    *alpha = 255;
+    
+    if(bench_check_wrap(&x, width, wrapMode) && bench_check_wrap(&y, height, wrapMode)){
+        bench_check_get_pixel(image, cimage, x, y, color, alpha);
+    }
+}
+
+static uint8_t bench_check_bilinear(const uint8_t values[4], int fx, int fy){
+    int top = values[0] * (256 - fx) + values[1] * fx;
+    int bottom = values[2] * (256 - fx) + values[3] * fx;
+    return (top * (256 - fy) + bottom * fy + 32768) >> 16;
+}
+
+// rotated, scaled and axis-aligned rows crossing the edges, for every wrap mode, filter and format
+static bool bench_check_affine(RIF_Image *image, RIF_CImage *cimage){
+    
+    int width = (image != NULL) ? image->width : cimage->width;
+    int height = (image != NULL) ? image->height : cimage->height;
+    
+    int count = 300;
+    
+    int32_t lines[][4] = {
+        { 0, 0, 1 << 16, 0 },
+        { -(7 << 16) - 0x8000, (height / 2) << 16, 0x18000, 0x4000 },
+        { (width / 2) << 16, -(3 << 16), -0x9000, 0xB000 },
+        { (width - 1) << 16, (height - 1) << 16, 0, 0x10000 },
+        { -(width << 16), -(height << 16), 0x23456, 0x1F00D }
+    };
+    
+    RIF_WrapMode wrapModes[] = { RIF_WrapClamp, RIF_WrapRepeat, RIF_WrapFill };
+    RIF_Filter filters[] = { RIF_FilterNearest, RIF_FilterBilinear };
+    
+    uint8_t *out = malloc(count * 2);
+    bool success = true;
+    
+    for(int l = 0; l < sizeof(lines) / sizeof(lines[0]); l++){
+        for(int w = 0; w < 3; w++){
+            for(int filter = 0; filter < 2; filter++){
+                for(int f = 0; f < 2; f++){
+                    int32_t u = lines[l][0];
+                    int32_t v = lines[l][1];
+                    int32_t du = lines[l][2];
+                    int32_t dv = lines[l][3];
+                    
+                    if(image != NULL){
+                        librif_image_sample_affine_row(image, u, v, du, dv, count, wrapModes[w], filters[filter], out, checkFormats[f]);
+                    }
+                    else {
+                        librif_cimage_sample_affine_row(cimage, u, v, du, dv, count, wrapModes[w], filters[filter], out, checkFormats[f]);
+                    }
+                    
+                    for(int i = 0; i < count; i++){
+                        uint8_t color, alpha;
+                        
+                        if(filters[filter] == RIF_FilterNearest){
+                            bench_check_sample(image, cimage, u >> 16, v >> 16, wrapModes[w], &color, &alpha);
+                        }
+                        else {
+                            // texel centers are at +0.5
+                            int32_t us = (int32_t)((uint32_t)u - 0x8000);
+                            int32_t vs = (int32_t)((uint32_t)v - 0x8000);
+                            
+                            uint8_t colors[4], alphas[4];
+                            for(int k = 0; k < 4; k++){
+                                bench_check_sample(image, cimage, (us >> 16) + (k & 1), (vs >> 16) + (k >> 1), wrapModes[w], &colors[k], &alphas[k]);
+                            }
+                            
+                            color = bench_check_bilinear(colors, (us >> 8) & 0xFF, (vs >> 8) & 0xFF);
+                            alpha = bench_check_bilinear(alphas, (us >> 8) & 0xFF, (vs >> 8) & 0xFF);
+                        }
+                        
+                        if(checkFormats[f] == RIF_PixelFormatColorAlpha){
+                            success &= (out[i * 2] == color && out[i * 2 + 1] == alpha);
+                        }
+                        else {
+                            success &= (out[i] == color);
+                        }
+                        
+                        u = (int32_t)((uint32_t)u + (uint32_t)du);
+                        v = (int32_t)((uint32_t)v + (uint32_t)dv);
+                    }
+                }
+            }
+        }
+    }
+    
+    free(out);
+    
+    return success;
+}
+
+static bool bench_check_write(const char *filename, const uint8_t *data, size_t size){
+    FILE *file = fopen(filename, "wb");
+    if(file == NULL){
+        return false;
+    }
+    bool success = fwrite(data, 1, size, file) == size;
+    fclose(file);
+    return success;
+}
+
+// both in-place opens of the same bytes, NULL or the pixels of reference
+static bool bench_check_open_bytes(const uint8_t *data, size_t size, bool compressed, RIF_Image *reference){
+    
+    const char *filename = compressed ? "check.rifc" : "check.rif";
+    if(!bench_check_write(filename, data, size)){
+        return false;
+    }
+    
+    bool success = true;
+    
+    for(int source = 0; source < 2; source++){
+        RIF_Image *image = NULL;
+        RIF_CImage *cimage = NULL;
+        
+        if(compressed){
+            cimage = (source == 0) ? librif_cimage_open_memory(data, size) : librif_cimage_open_mapped(filename);
+        }
+        else {
+            image = (source == 0) ? librif_image_open_memory(data, size) : librif_image_open_mapped(filename);
+        }
+        
+        if(reference == NULL){
+            success &= (image == NULL && cimage == NULL);
+        }
+        else if(image == NULL && cimage == NULL){
+            success = false;
+        }
+        else {
+            int width = compressed ? cimage->width : image->width;
+            int height = compressed ? cimage->height : image->height;
+            success &= (width == reference->width && height == reference->height);
+            
+            // the fast accessors chosen at open against the generic get_pixel of the reference
+            for(int y = 0; y < height && success; y++){
+                for(int x = 0; x < width; x++){
+                    uint8_t color, alpha, expectedColor, expectedAlpha;
+                    if(compressed){
+                        librif_cimage_get_pixel(cimage, x, y, &color, &alpha);
+                    }
+                    else {
+                        librif_image_get_pixel(image, x, y, &color, &alpha);
+                    }
+                    librif_image_get_pixel_generic(reference, x, y, &expectedColor, &expectedAlpha);
+                    success &= (color == expectedColor && alpha == expectedAlpha);
+                }
+            }
+        }
+        
+        if(image != NULL){
+            librif_image_free(image);
+        }
+        if(cimage != NULL){
+            librif_cimage_free(cimage);
+        }
+    }
+    
+    remove(filename);
+    
+    return success;
+}
+
+static void bench_check_put32(uint8_t *bytes, uint32_t value){
+    for(int i = 0; i < 4; i++){
+        bytes[i] = (uint8_t)(value >> (24 - i * 8));
+    }
+}
+
+static uint32_t bench_check_get32(const uint8_t *bytes){
+    return (uint32_t)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+}
+
+// valid, truncated and malformed files through open_memory and open_mapped
+static bool bench_check_open(const uint8_t *data, size_t size, RIF_CImage *cimage, RIF_Image *reference){
+    
+    bool success = bench_check_open_bytes(data, size, false, reference);
+    
+    uint8_t *copy = malloc(size);
+    
+    // raw: every truncation fails, then sizes whose pixels don't fit the data
+    size_t rawSizes[] = { 0, 1, 8, 9, size / 2, size - 1 };
+    for(int i = 0; i < sizeof(rawSizes) / sizeof(rawSizes[0]); i++){
+        success &= bench_check_open_bytes(data, rawSizes[i], false, NULL);
+    }
+    
+    uint32_t rawHeaders[][2] = {
+        { 0x80000000u, 1 },
+        { 0x10000, 0x10000 },
+        { reference->width, reference->height + 1 }
+    };
+    for(int i = 0; i < sizeof(rawHeaders) / sizeof(rawHeaders[0]); i++){
+        memcpy(copy, data, size);
+        bench_check_put32(&copy[1], rawHeaders[i][0]);
+        bench_check_put32(&copy[5], rawHeaders[i][1]);
+        success &= bench_check_open_bytes(copy, size, false, NULL);
+    }
+    
+    free(copy);
+    
+    if(!librif_cimage_write(cimage, "check-source.rifc")){
+        return false;
+    }
+    
+    FILE *file = fopen("check-source.rifc", "rb");
+    fseek(file, 0, SEEK_END);
+    size_t csize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *cdata = malloc(csize);
+    size_t readSize = fread(cdata, 1, csize, file);
+    fclose(file);
+    remove("check-source.rifc");
+    
+    success &= (readSize == csize);
+    success &= bench_check_open_bytes(cdata, csize, true, reference);
+    
+    // compressed: truncated in the header, the patterns and the cells
+    size_t patternsSize = (size_t)cimage->numberOfPatterns * cimage->patternSize * cimage->patternSize * (cimage->hasAlpha ? 2 : 1);
+    size_t compressedSizes[] = { 0, 24, 25, 25 + patternsSize / 2, 25 + patternsSize, csize - 1 };
+    for(int i = 0; i < sizeof(compressedSizes) / sizeof(compressedSizes[0]); i++){
+        success &= bench_check_open_bytes(cdata, compressedSizes[i], true, NULL);
+    }
+    
+    // width, height, cx, cy, patternSize, numberOfPatterns
+    uint32_t header[6];
+    for(int i = 0; i < 6; i++){
+        header[i] = bench_check_get32(&cdata[1 + i * 4]);
+    }
+    
+    uint32_t malformed[][6] = {
+        // no pattern size
+        { header[0], header[1], header[2], header[3], 0, header[5] },
+        // cells overflow 32 bits
+        { header[0], header[1], 0x10000, 0x10000, header[4], header[5] },
+        // wider than its cells
+        { header[2] * header[4] + 1, header[1], header[2], header[3], header[4], header[5] },
+        // cells but no patterns
+        { header[0], header[1], header[2], header[3], header[4], 0 },
+        // negative as an int
+        { 0x80000000u, header[1], header[2], header[3], header[4], header[5] }
+    };
+    
+    copy = malloc(csize);
+    
+    for(int i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++){
+        memcpy(copy, cdata, csize);
+        for(int k = 0; k < 6; k++){
+            bench_check_put32(&copy[1 + k * 4], malformed[i][k]);
+        }
+        success &= bench_check_open_bytes(copy, csize, true, NULL);
+    }
+    
+    // last cell index past the patterns, all bytes set works for every index size
+    memcpy(copy, cdata, csize);
+    unsigned int indexSize = (copy[0] >> 1 & 3) == 1 ? 1 : (copy[0] >> 1 & 3) == 2 ? 2 : 4;
+    memset(&copy[csize - indexSize], 0xFF, indexSize);
+    success &= bench_check_open_bytes(copy, csize, true, NULL);
+    
+    free(copy);
+    free(cdata);
+    
+    return success;
+}
+
+static bool bench_checks(void){
+    
+    bool success = true;
+    
+    for(int i = 0; i < sizeof(checkImages) / sizeof(checkImages[0]); i++){
+        const BenchCheckImage *check = &checkImages[i];
+        
+        size_t size;
+        uint8_t *data = bench_check_raw_data(check, &size);
+        
+        // the reference is read through the io path, which the in-place opens don't share
+        RIF_Image *image = librif_image_open_io(librif_io_memory(data, size), NULL);
+        librif_image_read(image, 0, NULL);
+        
+        RIF_EncodeOptions options = { .patternMin = check->patternSize, .patternMax = check->patternSize, .patternStep = 1 };
+        RIF_CImage *cimage = librif_image_compress(image, &options);
+        
+        bool copyRect = bench_check_copy_rect(image, NULL) && bench_check_copy_rect(NULL, cimage);
+        bool rows = bench_check_row_cursors(cimage);
+        bool dither = bench_check_dither(image, NULL) && bench_check_dither(NULL, cimage);
+        bool affine = bench_check_affine(image, NULL) && bench_check_affine(NULL, cimage);
+        bool open = bench_check_open(data, size, cimage, image);
+        
+        printf("check %dx%d%s, pattern %u\n", check->width, check->height, check->alpha ? " alpha" : "", check->patternSize);
+        printf("  copy_rect                   %s\n", copyRect ? "ok" : "MISMATCH");
+        printf("  row cursors                 %s\n", rows ? "ok" : "MISMATCH");
+        printf("  dither                      %s\n", dither ? "ok" : "MISMATCH");
+        printf("  affine sampling             %s\n", affine ? "ok" : "MISMATCH");
+        printf("  memory and mapped opens     %s\n", open ? "ok" : "MISMATCH");
+        
+        success &= copyRect && rows && dither && affine && open;
+        
+        librif_cimage_free(cimage);
+        librif_image_free(image);
+        free(data);
+    }
+    
+    return success;
+}
+
+int main(int argc, const char * argv[]) {
+    
+    librif_init();
+    
+    int status = 0;
+    
+    #ifdef RIF_TEST
+    if(!librif_check_decode()){
+        fprintf(stderr, "SIMD cell decoding doesn't match the scalar decoder\n");
+        status = 1;
+    }
+    #endif
+    
+    if(argc > 1 && strcmp(argv[1], "--json") == 0){
+        if(argc > 2){
+            bench_suite(&argv[2], argc - 2);
+        }
+        else {
+            int numberOfFiles = sizeof(suiteFilenames) / sizeof(suiteFilenames[0]);
+            int numberOfSizes = sizeof(suiteSyntheticSizes) / sizeof(suiteSyntheticSizes[0]);
+            
+            const char *names[numberOfFiles + numberOfSizes];
+            char syntheticNames[numberOfSizes][64];
+            
+            for(int i = 0; i < numberOfFiles; i++){
+                names[i] = suiteFilenames[i];
+            }
+            for(int i = 0; i < numberOfSizes; i++){
+                snprintf(syntheticNames[i], sizeof(syntheticNames[i]), "synthetic-%d", suiteSyntheticSizes[i]);
+                if(!bench_write_synthetic(syntheticNames[i], suiteSyntheticSizes[i])){
+                    fprintf(stderr, "%s: can't write\n", syntheticNames[i]);
+                }
+                names[numberOfFiles + i] = syntheticNames[i];
+            }
+            
+            bench_suite(names, numberOfFiles + numberOfSizes);
+        }
+    }
+    else if(argc > 1){
+        if(!bench_checks()){
+            status = 1;
+        }
+        
+        for(int i = 1; i < argc; i++){
+            bench_decompress(argv[i]);
+            bench_viewport(argv[i]);
+            bench_dither(argv[i]);
+            bench_affine(argv[i]);
+            bench_async(argv[i]);
+            bench_open_memory(argv[i]);
+            bench_budget(argv[i]);
+            if(!bench_open_decompressed(argv[i])){
+                status = 1;
+            }
+            if(!bench_pooled_load(argv[i])){
+                status = 1;
+            }
+        }
+        
+        if(!bench_stress(&argv[1], argc - 1)){
+            status = 1;
+        }
+    }
+    else {
+        if(!bench_checks()){
+            status = 1;
+        }
+        
+        for(int i = 0; i < sizeof(defaultFilenames) / sizeof(defaultFilenames[0]); i++){
+            bench_decompress(defaultFilenames[i]);
+            bench_viewport(defaultFilenames[i]);
+            bench_dither(defaultFilenames[i]);
+            bench_affine(defaultFilenames[i]);
+            bench_async(defaultFilenames[i]);
+            bench_open_memory(defaultFilenames[i]);
+            bench_budget(defaultFilenames[i]);
+            if(!bench_open_decompressed(defaultFilenames[i])){
+                status = 1;
+            }
+            if(!bench_pooled_load(defaultFilenames[i])){
+                status = 1;
+            }
+        }
+        
+        int numberOfFiles = sizeof(defaultFilenames) / sizeof(defaultFilenames[0]);
+        if(!bench_stress(defaultFilenames, numberOfFiles)){
+            status = 1;
+        }
+        
+        bench_cell_lookup(1024);
+        bench_cell_lookup(4096);
+        
+        if(!bench_decode_cells(4096, 4096)){
+            status = 1;
+        }
+        if(!bench_decode_cells(4096, 70000)){
+            status = 1;
+        }
+        
+        bench_get_pixel(8, false);
+        bench_get_pixel(8, true);
+        bench_get_pixel(6, false);
+    }
+    
+    return status;
+}
@@ -0,0 +1,99 @@
+-- Lua/C crossing cost of per-pixel calls against batched calls.
+-- Run with luaglue_bench from this directory.
+
+local filenames = { "../../images/track-1024.rif", "../../images/track-1024.rifc" }
+
+local viewportWidth = 400
+local viewportHeight = 240
+local frames = 20
+local samples = 100000
+
+local function measure(name, fn)
+    local start = os.clock()
+    local result = fn()
+    local elapsed = os.clock() - start
+    print(string.format("  %-32s %10.3f ms  (%s)", name, elapsed * 1000, tostring(result)))
+end
+
+for _, filename in ipairs(filenames) do
+
+    local image
+    if filename:sub(-5) == ".rifc" then
+        image = librif.cimage.open(filename)
+    else
+        image = librif.image.open(filename)
+    end
+
+    image:read()
+
+    local width = image:getWidth()
+    local height = image:getHeight()
+
+    print(filename .. ": " .. width .. "x" .. height)
+
+    -- count black pixels in viewports
+
+    measure("viewport getPixel", function()
+        local count = 0
+        for frame = 1, frames do
+            for y = 0, viewportHeight - 1 do
+                for x = 0, viewportWidth - 1 do
+                    local color = image:getPixel(frame + x, frame + y)
+                    if color == 0 then
+                        count = count + 1
+                    end
+                end
+            end
+        end
+        return count
+    end)
+
+    measure("viewport getPixels", function()
+        local count = 0
+        for frame = 1, frames do
+            local pixels = image:getPixels(frame, frame, viewportWidth, viewportHeight)
+            for _ in pixels:gmatch("\0") do
+                count = count + 1
+            end
+        end
+        return count
+    end)
+
+    -- random probe points
+
+    local xs = {}
+    local ys = {}
+    math.randomseed(1)
+    for i = 1, samples do
+        xs[i] = math.random(0, width - 1)
+        ys[i] = math.random(0, height - 1)
+    end
+
+    measure("probes getPixel", function()
+        local sum = 0
+        for i = 1, samples do
+            sum = sum + image:getPixel(xs[i], ys[i])
+        end
+        return sum
+    end)
+
+    measure("probes sampleMany (with packing)", function()
+        local format = string.rep("i4", 1000)
+        local sum = 0
+        for i = 1, samples, 1000 do
+            local packedX = string.pack(format, table.unpack(xs, i, i + 999))
+            local packedY = string.pack(format, table.unpack(ys, i, i + 999))
+            local colors = image:sampleMany(packedX, packedY)
+            for j = 1, #colors do
+                sum = sum + colors:byte(j)
+            end
+        end
+        return sum
+    end)
+
+    -- rects that can't be allocated or overflow coordinates return nil, the scratch buffer is kept
+
+    assert(image:getPixels(0, 0, 0x7fffffff, 0x7fffffff, true) == nil)
+    assert(image:getPixels(0x7ffffff0, 0, 0x100, 1) == nil)
+    assert(#image:getPixels(0, 0, viewportWidth, viewportHeight) == viewportWidth * viewportHeight)
+end
@@ -0,0 +1,318 @@
+//
+//  luaglue_bench.c
+//  librif
+//
+//  Runs the Lua glue on Linux with a stock Lua 5.4 through a stubbed PlaydateAPI,
+//  then executes a Lua benchmark script.
+//
+//  cc -O2 -DTARGET_EXTENSION -I. -I../../src -I/usr/include/lua5.4
+//     luaglue_bench.c ../../src/librif.c ../../src/librif_luaglue.c -llua5.4 -lm -o luaglue_bench
+//  ./luaglue_bench bench.lua
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "librif_luaglue.h"
+
+static lua_State *stubL = NULL;
+
+//
+// System
+//
+
+static void* stub_realloc(void *ptr, size_t size){
+    if(size == 0){
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, size);
+}
+
+static void stub_logToConsole(const char *fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+}
+
+static void stub_error(const char *fmt, ...){
+    char message[512];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    luaL_error(stubL, "%s", message);
+}
+
+static struct timespec stubStartTime;
+
+static unsigned int stub_getCurrentTimeMilliseconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned int)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static float stub_getElapsedTime(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (float)((ts.tv_sec - stubStartTime.tv_sec) + (ts.tv_nsec - stubStartTime.tv_nsec) / 1e9);
+}
+
+static void stub_resetElapsedTime(void){
+    clock_gettime(CLOCK_MONOTONIC, &stubStartTime);
+}
+
+static const struct playdate_sys stubSystem = {
+    .realloc = stub_realloc,
+    .logToConsole = stub_logToConsole,
+    .error = stub_error,
+    .getCurrentTimeMilliseconds = stub_getCurrentTimeMilliseconds,
+    .getElapsedTime = stub_getElapsedTime,
+    .resetElapsedTime = stub_resetElapsedTime
+};
+
+//
+// File
+//
+
+static SDFile* stub_open(const char *name, FileOptions mode){
+    return fopen(name, (mode & kFileWrite) ? "wb" : (mode & kFileAppend) ? "ab" : "rb");
+}
+
+static int stub_close(SDFile *file){
+    return fclose(file);
+}
+
+static int stub_read(SDFile *file, void *buf, unsigned int len){
+    size_t n = fread(buf, 1, len, file);
+    return (n == 0 && ferror(file)) ? -1 : (int)n;
+}
+
+static int stub_write(SDFile *file, const void *buf, unsigned int len){
+    size_t n = fwrite(buf, 1, len, file);
+    return (n == 0 && ferror(file)) ? -1 : (int)n;
+}
+
+static int stub_seek(SDFile *file, int pos, int whence){
+    return fseek(file, pos, whence);
+}
+
+static int stub_tell(SDFile *file){
+    return (int)ftell(file);
+}
+
+static const struct playdate_file stubFile = {
+    .open = stub_open,
+    .close = stub_close,
+    .read = stub_read,
+    .write = stub_write,
+    .seek = stub_seek,
+    .tell = stub_tell
+};
+
+//
+// Lua
+//
+
+// objects are full userdata holding the C pointer, with the class name as metatable
+typedef struct {
+    void *object;
+} StubObject;
+
+static int stub_registerClass(const char *name, const lua_reg *reg, const lua_val *vals, int isstatic, const char **outErr){
+    
+    lua_State *L = stubL;
+    
+    luaL_newmetatable(L, name);
+    lua_newtable(L);
+    
+    for(const lua_reg *r = reg; r->name != NULL; r++){
+        lua_pushcfunction(L, r->func);
+        
+        if(strcmp(r->name, "__gc") == 0){
+            lua_setfield(L, -3, "__gc");
+        }
+        else {
+            lua_pushvalue(L, -1);
+            lua_setfield(L, -3, r->name);
+            lua_pop(L, 1);
+        }
+    }
+    
+    // metatable.__index = class table
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -3, "__index");
+    
+    // class table at the dotted global path, e.g. librif.image
+    lua_pushglobaltable(L);
+    
+    char path[256];
+    snprintf(path, sizeof(path), "%s", name);
+    
+    char *component = path;
+    char *dot;
+    
+    while((dot = strchr(component, '.')) != NULL){
+        *dot = '\0';
+        
+        if(lua_getfield(L, -1, component) != LUA_TTABLE){
+            lua_pop(L, 1);
+            lua_newtable(L);
+            lua_pushvalue(L, -1);
+            lua_setfield(L, -3, component);
+        }
+        lua_remove(L, -2);
+        
+        component = dot + 1;
+    }
+    
+    lua_pushvalue(L, -2);
+    lua_setfield(L, -2, component);
+    
+    lua_pop(L, 3);
+    
+    return 1;
+}
+
+static int stub_getArgCount(void){
+    return lua_gettop(stubL);
+}
+
+static int stub_argIsNil(int pos){
+    return lua_isnoneornil(stubL, pos);
+}
+
+static int stub_getArgBool(int pos){
+    return lua_toboolean(stubL, pos);
+}
+
+static int stub_getArgInt(int pos){
+    return (int)lua_tointeger(stubL, pos);
+}
+
+static float stub_getArgFloat(int pos){
+    return (float)lua_tonumber(stubL, pos);
+}
+
+static const char* stub_getArgString(int pos){
+    return lua_tostring(stubL, pos);
+}
+
+static const char* stub_getArgBytes(int pos, size_t *outlen){
+    return lua_tolstring(stubL, pos, outlen);
+}
+
+static void* stub_getArgObject(int pos, char *type, LuaUDObject **outud){
+    
+    // __gc receives the object as its only argument
+    if(pos <= 0){
+        pos = 1;
+    }
+    
+    StubObject *ud = luaL_testudata(stubL, pos, type);
+    
+    if(outud != NULL){
+        *outud = (LuaUDObject*)ud;
+    }
+    
+    return (ud != NULL) ? ud->object : NULL;
+}
+
+static void stub_pushNil(void){
+    lua_pushnil(stubL);
+}
+
+static void stub_pushBool(int val){
+    lua_pushboolean(stubL, val);
+}
+
+static void stub_pushInt(int val){
+    lua_pushinteger(stubL, val);
+}
+
+static void stub_pushFloat(float val){
+    lua_pushnumber(stubL, val);
+}
+
+static void stub_pushString(const char *str){
+    lua_pushstring(stubL, str);
+}
+
+static void stub_pushBytes(const char *str, size_t len){
+    lua_pushlstring(stubL, str, len);
+}
+
+static LuaUDObject* stub_pushObject(void *obj, char *type, int nValues){
+    StubObject *ud = lua_newuserdatauv(stubL, sizeof(StubObject), 0);
+    ud->object = obj;
+    luaL_setmetatable(stubL, type);
+    return (LuaUDObject*)ud;
+}
+
+// objects live as long as Lua references them, retain and release are not tracked
+static LuaUDObject* stub_retainObject(LuaUDObject *obj){
+    return obj;
+}
+
+static void stub_releaseObject(LuaUDObject *obj){
+    
+}
+
+static const struct playdate_lua stubLua = {
+    .registerClass = stub_registerClass,
+    .getArgCount = stub_getArgCount,
+    .argIsNil = stub_argIsNil,
+    .getArgBool = stub_getArgBool,
+    .getArgInt = stub_getArgInt,
+    .getArgFloat = stub_getArgFloat,
+    .getArgString = stub_getArgString,
+    .getArgBytes = stub_getArgBytes,
+    .getArgObject = stub_getArgObject,
+    .pushNil = stub_pushNil,
+    .pushBool = stub_pushBool,
+    .pushInt = stub_pushInt,
+    .pushFloat = stub_pushFloat,
+    .pushString = stub_pushString,
+    .pushBytes = stub_pushBytes,
+    .pushObject = stub_pushObject,
+    .retainObject = stub_retainObject,
+    .releaseObject = stub_releaseObject
+};
+
+static PlaydateAPI stubAPI = {
+    .system = &stubSystem,
+    .file = &stubFile,
+    .lua = &stubLua
+};
+
+int main(int argc, const char * argv[]) {
+    
+    const char *script = (argc > 1) ? argv[1] : "bench.lua";
+    
+    stubL = luaL_newstate();
+    luaL_openlibs(stubL);
+    
+    stub_resetElapsedTime();
+    
+    librif_init(&stubAPI);
+    librif_register_lua();
+    
+    if(luaL_dofile(stubL, script) != LUA_OK){
+        fprintf(stderr, "%s\n", lua_tostring(stubL, -1));
+        lua_close(stubL);
+        return 1;
+    }
+    
+    lua_close(stubL);
+    
+    return 0;
+}
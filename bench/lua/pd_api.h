@@ -0,0 +1,90 @@
+//
+//  pd_api.h
+//  librif
+//
+//  Minimal stand-in for the Playdate SDK header, used to run the Lua glue
+//  on Linux against a stock Lua 5.4. Only the calls used by librif are declared.
+//
+
+#ifndef pd_api_h
+#define pd_api_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <lua.h>
+
+typedef void SDFile;
+typedef struct LuaUDObject LuaUDObject;
+
+typedef struct {
+    const char *name;
+    lua_CFunction func;
+} lua_reg;
+
+typedef struct {
+    const char *name;
+    int type;
+    union {
+        unsigned int intval;
+        float floatval;
+        const char *strval;
+    } v;
+} lua_val;
+
+typedef enum {
+    kFileRead = (1 << 0),
+    kFileReadData = (1 << 1),
+    kFileWrite = (1 << 2),
+    kFileAppend = (2 << 2)
+} FileOptions;
+
+struct playdate_sys {
+    void* (*realloc)(void *ptr, size_t size);
+    void (*logToConsole)(const char *fmt, ...);
+    void (*error)(const char *fmt, ...);
+    unsigned int (*getCurrentTimeMilliseconds)(void);
+    float (*getElapsedTime)(void);
+    void (*resetElapsedTime)(void);
+};
+
+struct playdate_file {
+    SDFile* (*open)(const char *name, FileOptions mode);
+    int (*close)(SDFile *file);
+    int (*read)(SDFile *file, void *buf, unsigned int len);
+    int (*write)(SDFile *file, const void *buf, unsigned int len);
+    int (*seek)(SDFile *file, int pos, int whence);
+    int (*tell)(SDFile *file);
+};
+
+struct playdate_lua {
+    int (*registerClass)(const char *name, const lua_reg *reg, const lua_val *vals, int isstatic, const char **outErr);
+    
+    int (*getArgCount)(void);
+    int (*argIsNil)(int pos);
+    int (*getArgBool)(int pos);
+    int (*getArgInt)(int pos);
+    float (*getArgFloat)(int pos);
+    const char* (*getArgString)(int pos);
+    const char* (*getArgBytes)(int pos, size_t *outlen);
+    void* (*getArgObject)(int pos, char *type, LuaUDObject **outud);
+    
+    void (*pushNil)(void);
+    void (*pushBool)(int val);
+    void (*pushInt)(int val);
+    void (*pushFloat)(float val);
+    void (*pushString)(const char *str);
+    void (*pushBytes)(const char *str, size_t len);
+    LuaUDObject* (*pushObject)(void *obj, char *type, int nValues);
+    
+    LuaUDObject* (*retainObject)(LuaUDObject *obj);
+    void (*releaseObject)(LuaUDObject *obj);
+};
+
+typedef struct PlaydateAPI {
+    const struct playdate_sys *system;
+    const struct playdate_file *file;
+    const struct playdate_lua *lua;
+} PlaydateAPI;
+
+#endif /* pd_api_h */
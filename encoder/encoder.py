@@ -2,6 +2,8 @@ import os
 import math
 import time
 import argparse
+import multiprocessing
+import numpy as np
 from PIL import Image
 
 # configuration
@@ -19,276 +21,263 @@ parser.add_argument("-c", "--compress", help="compress the image", action="store
 parser.add_argument("-pmin", "--pattern-min", type=int, help="minimum pattern size", default=8)
 parser.add_argument("-pmax", "--pattern-max", type=int, help="maximum pattern size", default=8)
 parser.add_argument("-pstep", "--pattern-step", type=int, help="step used to find the pattern", default=2)
+parser.add_argument("-j", "--jobs", type=int, help="number of processes used to find the pattern size (default: cpu count)", default=0)
 parser.add_argument("-png", help="save grayscale png output", action="store_true")
 
-args = parser.parse_args()
+verbose = False
 
-input_file = args.input
-
-verbose = args.verbose
-compressed = args.compress
-
-min_pattern_size = args.pattern_min
-max_pattern_size = args.pattern_max
-pattern_step = args.pattern_step
-
-png_output = args.png
+# rows of cells hashed at once while searching the pattern size
+search_band_rows = 16
 
 def console_print(str):
     if verbose:
         print(str)
 
-def get_pattern(im_pixels, start_x, start_y, w, h, s):
+def get_cells(pixels, s):
+    # returns an array of shape (cells, s * s * channels), one row per cell
 
-    pixels = []
-    hash = 0
+    h, w, channels = pixels.shape
 
-    color_count = 0
+    p_x = math.ceil(w / s)
+    p_y = math.ceil(h / s)
 
-    for j in range(0, s):
-        y = start_y + j
+    # pixels outside the image are (0, 255)
+    padded = np.zeros((p_y * s, p_x * s, channels), dtype=np.uint8)
+    if channels > 1:
+        padded[:, :, 1] = 255
+    padded[:h, :w] = pixels
 
-        for z in range(0, s):
-            x = start_x + z
+    cells = padded.reshape(p_y, s, p_x, s, channels).transpose(0, 2, 1, 3, 4)
+    return np.ascontiguousarray(cells).reshape(p_y * p_x, s * s * channels)
 
-            pixel = (0, 255)
+def unique_cells(cells):
+    # unique rows in order of first occurrence, with the pattern index of every cell
 
-            if y < h and x < w:
-                pixel = im_pixels[y][x]
+    cell_bytes = cells.shape[1]
+    keys = cells.view(np.dtype((np.void, cell_bytes))).ravel()
 
-            color, alpha = pixel
+    _, first_index, inverse = np.unique(keys, return_index=True, return_inverse=True)
 
-            if not (alpha == 0):
-                color_count += 1
+    order = np.argsort(first_index, kind="stable")
+    rank = np.empty_like(order)
+    rank[order] = np.arange(len(order))
 
-            hash += (color + alpha)
-            pixels.append(pixel)
+    return first_index[order], rank[inverse.ravel()]
 
-    return (hash, pixels, color_count)
+# search worker state, inherited from the parent process
 
-def find_pattern(pattern, patterns):
+search_pixels = None
+search_alpha = False
+search_best = None
 
-    hash = pattern[0]
-    pixels = pattern[1]
+def init_search(pixels, alpha_channel, best):
+    global search_pixels, search_alpha, search_best
+    search_pixels = pixels
+    search_alpha = alpha_channel
+    search_best = best
 
-    for i in range(0, len(patterns)):
-        pattern_1 = patterns[i]
-        hash_1 = pattern_1[0]
-        pixels_1 = pattern_1[1]
+def cell_index_size(patterns_count):
+    # smallest cell index size in bytes
+    if patterns_count <= 0x100:
+        return 1
+    if patterns_count <= 0x10000:
+        return 2
+    return 4
 
-        if hash == hash_1:
-            if pixels == pixels_1:
-                return i
+def cell_index_flags(index_size):
+    # stored in bits 1-2 of the flags byte, 0 is the original 32-bit format
+    return { 1: 1 << 1, 2: 2 << 1, 4: 0 }[index_size]
 
-    return -1
+def pattern_memory(pattern):
+    s_bytes = pattern.shape[0]
 
-image_path = os.path.join(working_dir, input_file)
+    if search_alpha:
+        # s * s color bytes plus one for each visible pixel
+        return s_bytes // 2 + int(np.count_nonzero(pattern[1::2]))
+    return s_bytes
 
-if os.path.isabs(input_file):
-    image_path = input_file
-    output_dir = os.path.dirname(image_path)
+def search_pattern_size(s):
+    start_time = time.time()
 
-filename = os.path.basename(image_path)
-filename_no_ext = os.path.splitext(filename)[0]
+    h, w, _ = search_pixels.shape
+    p_x = math.ceil(w / s)
 
-console_print("encoding " + filename)
+    cells = get_cells(search_pixels, s)
 
-alpha_channel = False
+    patterns_memory = 0
+    memory_sum = 0
+    cells_count = 0
+    known = set()
 
-im = Image.open(image_path)
-im = im.convert('RGBA')
+    band_size = p_x * search_band_rows
 
-w, h = im.size
-pixels_n = w * h
+    for start in range(0, cells.shape[0], band_size):
+        band = cells[start:start + band_size]
+        first_index, _ = unique_cells(band)
 
-rgb_pixels = im.load()
+        for i in first_index:
+            pattern = band[i]
+            key = pattern.tobytes()
 
-# get pixels
+            if key not in known:
+                known.add(key)
+                patterns_memory += pattern_memory(pattern)
 
-pixels = [[] for i in range(0,h)]
+        # count cell bytes, the index size only grows with new patterns
+        cells_count += band.shape[0]
+        memory_sum = patterns_memory + cells_count * cell_index_size(len(known))
 
-for y in range(0, h):
-    pixels[y] = [() for i in range(0,w)]
+        best = search_best.value
+        if best >= 0 and memory_sum > best:
+            return None
 
-    for x in range(0, w):
-        rgb_pixel = rgb_pixels[x,y]
-        r, g, b, alpha = rgb_pixel
+    elapsed_time_formatted = "{:.2f}".format(time.time() - start_time)
+    console_print(str(s) + "x" + str(s) + " [ " + str(memory_sum) + " bytes ] [ " + elapsed_time_formatted + " s ]")
 
-        color = round(0.2125 * r + 0.7154 * g + 0.0721 * b)
-        pixel = (color, alpha)
+    with search_best.get_lock():
+        if search_best.value < 0 or memory_sum < search_best.value:
+            search_best.value = memory_sum
 
-        if not (alpha == 255):
-            alpha_channel = True
+    return (s, memory_sum, len(known))
 
-        pixels[y][x] = pixel
+def main():
+    global verbose, output_dir
 
-if png_output:
-    output_filename = os.path.join(output_dir, filename_no_ext + "-grayscale.png")
-    output_im = Image.new('RGBA', (w, h))
-    output_pixels = output_im.load()
+    args = parser.parse_args()
 
-    for y in range(0, h):
-        for x in range(0, w):
-            color, alpha = pixels[y][x]
-            output_pixels[x,y] = (color, color, color, alpha)
+    input_file = args.input
 
-    output_im.save(output_filename)
+    verbose = args.verbose
+    compressed = args.compress
 
-data = bytearray()
+    min_pattern_size = args.pattern_min
+    max_pattern_size = args.pattern_max
+    pattern_step = args.pattern_step
 
-alpha_channel_int = 1 if alpha_channel else 0
-data.extend(alpha_channel_int.to_bytes(1, byteorder="big"))
+    png_output = args.png
 
-data.extend(w.to_bytes(4, byteorder="big"))
-data.extend(h.to_bytes(4, byteorder="big"))
+    image_path = os.path.join(working_dir, input_file)
 
-if compressed:
-    # find pattern size
+    if os.path.isabs(input_file):
+        image_path = input_file
+        output_dir = os.path.dirname(image_path)
 
-    console_print("find pattern size...")
+    filename = os.path.basename(image_path)
+    filename_no_ext = os.path.splitext(filename)[0]
 
-    min_memory = ()
-    min_memory_set = False
+    console_print("encoding " + filename)
 
-    start_time = time.time()
+    im = Image.open(image_path)
+    im = im.convert('RGBA')
 
-    safe_max = max(min_pattern_size, min(max_pattern_size, w))
+    w, h = im.size
 
-    for k in range(min_pattern_size, safe_max + 1, pattern_step):
-        s = safe_max - (k - min_pattern_size)
-        p_x = math.ceil(w / s)
-        p_y = math.ceil(h / s)
+    # get pixels
 
-        memory_sum = 0
-        save_memory = True
-        patterns = []
+    rgba = np.asarray(im, dtype=np.float64)
+    r, g, b = rgba[:, :, 0], rgba[:, :, 1], rgba[:, :, 2]
 
-        for j in range(0, p_y):
-            break_j = False
+    colors = np.round(0.2125 * r + 0.7154 * g + 0.0721 * b).astype(np.uint8)
+    alphas = np.asarray(im, dtype=np.uint8)[:, :, 3]
 
-            y = j * s
+    alpha_channel = bool(np.any(alphas != 255))
 
-            elapsed_time_formatted = "{:.2f}".format(time.time() - start_time)
-            console_print(str(s) + "x" + str(s) + " at [ " + str(y) + " ] [ " + elapsed_time_formatted + " s ]")
+    if png_output:
+        output_filename = os.path.join(output_dir, filename_no_ext + "-grayscale.png")
+        output_pixels = np.stack([colors, colors, colors, alphas], axis=2)
+        Image.fromarray(output_pixels, 'RGBA').save(output_filename)
 
-            for z in range(0, p_x):
-                x = z * s
-                
-                pattern = get_pattern(pixels, x, y, w, h, s)
-                color_count = pattern[2]
+    # pixels as (h, w, channels), alpha is stored only when needed
 
-                found_index = find_pattern(pattern, patterns)
+    if alpha_channel:
+        pixels = np.stack([colors, alphas], axis=2)
+    else:
+        pixels = colors.reshape(h, w, 1)
 
-                if found_index < 0:
+    data = bytearray()
 
-                    # count pattern bytes
-                    if alpha_channel:
-                        memory_sum += s * s
-                        memory_sum += color_count
-                    else:
-                        memory_sum += s * s
+    alpha_channel_int = 1 if alpha_channel else 0
+    data.extend(alpha_channel_int.to_bytes(1, byteorder="big"))
 
-                    patterns.append(pattern)
+    data.extend(w.to_bytes(4, byteorder="big"))
+    data.extend(h.to_bytes(4, byteorder="big"))
 
-                # count cell bytes
-                memory_sum += 4
+    if compressed:
+        # find pattern size
 
-                if min_memory_set and memory_sum > min_memory[1]:
-                    save_memory = False
-                    break_j = True
-                    break
-                    
-            if break_j:
-                break
-        
-        if save_memory:
-            memory = (s, memory_sum, len(patterns))
+        console_print("find pattern size...")
 
-            if not min_memory_set:
-                min_memory_set = True
-                min_memory = memory
+        safe_max = max(min_pattern_size, min(max_pattern_size, w))
+        sizes = [safe_max - (k - min_pattern_size) for k in range(min_pattern_size, safe_max + 1, pattern_step)]
 
-            if memory[1] <= min_memory[1]:
-                min_memory = memory
+        jobs = args.jobs if args.jobs > 0 else multiprocessing.cpu_count()
+        jobs = max(1, min(jobs, len(sizes)))
 
-    # read cells
+        best = multiprocessing.Value('q', -1)
 
-    pattern_info =  []
+        if jobs > 1:
+            with multiprocessing.Pool(jobs, initializer=init_search, initargs=(pixels, alpha_channel, best)) as pool:
+                results = pool.map(search_pattern_size, sizes)
+        else:
+            init_search(pixels, alpha_channel, best)
+            results = [search_pattern_size(s) for s in sizes]
 
-    pattern_info.append("pattern size: " + str(min_memory[0]))
-    pattern_info.append("pattern count: " + str(min_memory[2]))
-    pattern_info.append("bytes: " + str(min_memory[1]))
+        # same choice as the sequential search, ties are won by the smaller size
 
-    console_print(', '.join(pattern_info))
+        min_memory = None
 
-    pattern_size = min_memory[0]
+        for memory in results:
+            if memory is not None and (min_memory is None or memory[1] <= min_memory[1]):
+                min_memory = memory
 
-    patterns = []
-    cells = []
+        pattern_info =  []
 
-    p_x = math.ceil(w / pattern_size)
-    p_y = math.ceil(h / pattern_size)
+        pattern_info.append("pattern size: " + str(min_memory[0]))
+        pattern_info.append("pattern count: " + str(min_memory[2]))
+        pattern_info.append("bytes: " + str(min_memory[1]))
 
-    for j in range(0, p_y):
-        y = j * pattern_size
+        console_print(', '.join(pattern_info))
 
-        for z in range(0, p_x):
-            x = z * pattern_size
+        pattern_size = min_memory[0]
 
-            pattern = get_pattern(pixels, x, y, w, h, pattern_size)
-                
-            index = 0
-            found_index = find_pattern(pattern, patterns)
+        # read cells
 
-            if found_index >= 0:
-                index = found_index
-            else:
-                index = len(patterns)
-                patterns.append(pattern)
+        p_x = math.ceil(w / pattern_size)
+        p_y = math.ceil(h / pattern_size)
 
-            cells.append(index)
+        cells = get_cells(pixels, pattern_size)
+        first_index, cell_indexes = unique_cells(cells)
 
-    # write data
+        index_size = cell_index_size(len(first_index))
+        data[0] |= cell_index_flags(index_size)
 
-    data.extend(p_x.to_bytes(4, byteorder="big"))
-    data.extend(p_y.to_bytes(4, byteorder="big"))
+        # write data
 
-    data.extend(pattern_size.to_bytes(4, byteorder="big"))
-    data.extend(len(patterns).to_bytes(4, byteorder="big"))
+        data.extend(p_x.to_bytes(4, byteorder="big"))
+        data.extend(p_y.to_bytes(4, byteorder="big"))
 
-    for pattern in patterns:
-        pattern_pixels = pattern[1]
+        data.extend(pattern_size.to_bytes(4, byteorder="big"))
+        data.extend(len(first_index).to_bytes(4, byteorder="big"))
 
-        for pixel in pattern_pixels:
-            color, alpha = pixel
-            
-            data.extend(color.to_bytes(1, byteorder="big"))
-            if alpha_channel:
-                data.extend(alpha.to_bytes(1, byteorder="big"))
+        data.extend(cells[first_index].tobytes())
+        data.extend(cell_indexes.astype(">u" + str(index_size)).tobytes())
 
-    for index in cells:
-        data.extend(index.to_bytes(4, byteorder="big"))
-    
-else:
-    # write data
+    else:
+        # write data
 
-    for y in range(0, h):
-        for x in range(0, w):
-            pixel = pixels[y][x]
-            color, alpha = pixel
+        data.extend(pixels.tobytes())
 
-            data.extend(color.to_bytes(1, byteorder="big"))
-            if alpha_channel:
-                data.extend(alpha.to_bytes(1, byteorder="big"))
+    if os.path.isdir(output_dir):
+        extension = "rif"
+        if compressed:
+            extension = "rifc"
+        output_filename = filename_no_ext + "." + extension
 
-if os.path.isdir(output_dir):
-    extension = "rif"
-    if compressed:
-        extension = "rifc"
-    output_filename = filename_no_ext + "." + extension
+        f = open(os.path.join(output_dir, output_filename), "wb")
+        f.write(data)
+        f.close()
 
-    f = open(os.path.join(output_dir, output_filename), "wb")
-    f.write(data)
-    f.close()
+    console_print(output_filename + " saved")
 
-console_print(output_filename + " saved")
\ No newline at end of file
+if __name__ == "__main__":
+    main()
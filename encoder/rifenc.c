@@ -0,0 +1,120 @@
+//
+//  rifenc.c
+//  librif
+//
+//  Command-line encoder from raw .rif to compressed .rifc
+//
+//  cc -O2 -I../src rifenc.c ../src/librif.c -lm -pthread -o rifenc
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "librif.h"
+
+static void print_usage(void){
+    printf("usage: rifenc [-pmin size] [-pmax size] [-pstep step] [-v] input.rif [output.rifc]\n");
+}
+
+int main(int argc, const char * argv[]) {
+    
+    RIF_EncodeOptions options = {
+        .patternMin = 8,
+        .patternMax = 8,
+        .patternStep = 2
+    };
+    
+    bool verbose = false;
+    
+    const char *input = NULL;
+    const char *output = NULL;
+    
+    for(int i = 1; i < argc; i++){
+        const char *arg = argv[i];
+        
+        if((strcmp(arg, "-pmin") == 0 || strcmp(arg, "--pattern-min") == 0) && i + 1 < argc){
+            options.patternMin = atoi(argv[++i]);
+        }
+        else if((strcmp(arg, "-pmax") == 0 || strcmp(arg, "--pattern-max") == 0) && i + 1 < argc){
+            options.patternMax = atoi(argv[++i]);
+        }
+        else if((strcmp(arg, "-pstep") == 0 || strcmp(arg, "--pattern-step") == 0) && i + 1 < argc){
+            options.patternStep = atoi(argv[++i]);
+        }
+        else if(strcmp(arg, "-v") == 0 || strcmp(arg, "--verbose") == 0){
+            verbose = true;
+        }
+        else if(input == NULL){
+            input = arg;
+        }
+        else if(output == NULL){
+            output = arg;
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+    
+    if(input == NULL){
+        print_usage();
+        return 1;
+    }
+    
+    char outputBuffer[4096];
+    
+    if(output == NULL){
+        // input name with .rifc extension
+        const char *extension = strrchr(input, '.');
+        size_t length = (extension != NULL && strchr(extension, '/') == NULL) ? (size_t)(extension - input) : strlen(input);
+        
+        if(length + 6 > sizeof(outputBuffer)){
+            fprintf(stderr, "rifenc: path too long\n");
+            return 1;
+        }
+        
+        memcpy(outputBuffer, input, length);
+        strcpy(&outputBuffer[length], ".rifc");
+        output = outputBuffer;
+    }
+    
+    librif_init();
+    
+    RIF_Image *image = librif_image_open(input, NULL);
+    if(image == NULL){
+        fprintf(stderr, "rifenc: can't open %s\n", input);
+        return 1;
+    }
+    
+    librif_image_read(image, 0, NULL);
+    
+    clock_t start = clock();
+    
+    RIF_CImage *cimage = librif_image_compress(image, &options);
+    if(cimage == NULL){
+        fprintf(stderr, "rifenc: can't compress %s\n", input);
+        return 1;
+    }
+    
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    
+    if(verbose){
+        printf("pattern size: %u, pattern count: %u, bytes: %zu [ %.3f s ]\n", cimage->patternSize, cimage->numberOfPatterns, cimage->totalBytes, elapsed);
+    }
+    
+    if(!librif_cimage_write(cimage, output)){
+        fprintf(stderr, "rifenc: can't write %s\n", output);
+        return 1;
+    }
+    
+    if(verbose){
+        printf("%s saved\n", output);
+    }
+    
+    librif_cimage_free(cimage);
+    librif_image_free(image);
+    
+    return 0;
+}
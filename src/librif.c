@@ -8,34 +8,185 @@
 #include "librif.h"
 #include <math.h>
 
+#if !defined(RIF_PLAYDATE) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RIF_SIMD_X86
+#include <immintrin.h>
+#elif !defined(RIF_PLAYDATE) && defined(__aarch64__) && defined(__ARM_NEON)
+#define RIF_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#ifndef RIF_PLAYDATE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#endif
+
 #ifdef RIF_PLAYDATE
 PlaydateAPI *RIF_pd;
 #endif
 
-static const size_t patternIndexInBytes = 4;
+#ifdef RIF_TRACE
+typedef struct {
+    RIF_TracePhase phase;
+    uint64_t start;
+    unsigned int reads;
+    unsigned int allocations;
+} RIF_TraceScope;
+
+static void librif_trace_begin(RIF_TraceScope *scope, RIF_TracePhase phase);
+static void librif_trace_end(RIF_TraceScope *scope, size_t bytes);
+static void librif_trace_count(bool read);
+
+#define RIF_TRACE_BEGIN(phase) RIF_TraceScope traceScope; librif_trace_begin(&traceScope, phase)
+#define RIF_TRACE_END(bytes) librif_trace_end(&traceScope, bytes)
+#define RIF_TRACE_COUNT_READ() librif_trace_count(true)
+#define RIF_TRACE_COUNT_ALLOCATION() librif_trace_count(false)
+#else
+#define RIF_TRACE_BEGIN(phase)
+#define RIF_TRACE_END(bytes)
+#define RIF_TRACE_COUNT_READ()
+#define RIF_TRACE_COUNT_ALLOCATION()
+#endif
+
+static const uint8_t alphaFlag = 0x01;
+
+static bool librif_read_uint8(RIF_Image *image, uint8_t *value);
+static bool librif_read_uint32(RIF_Image *image, uint32_t *value);
+
+static bool librifc_read_uint8(RIF_CImage *image, uint8_t *value);
+static bool librifc_read_uint32(RIF_CImage *image, uint32_t *value);
+
+static const size_t headerSizeInBytes = 9;
+static const size_t cheaderSizeInBytes = 25;
 
-static uint8_t librif_read_uint8(RIF_Image *image);
-static uint32_t librif_read_uint32(RIF_Image *image);
+static bool librif_io_file(RIF_IO *io, const char *filename);
+static bool librif_io_begin(RIF_IO *io, size_t minSize);
+static bool librif_io_has_bytes(RIF_IO *io, size_t size);
+static void librif_io_close(RIF_IO *io, bool *hasIO);
+static size_t librif_io_read(RIF_IO *io, void *buffer, size_t size);
 
-static uint8_t librifc_read_uint8(RIF_CImage *image);
-static uint32_t librifc_read_uint32(RIF_CImage *image);
+static uint64_t librif_time(void);
+static size_t librif_budget_size(float rate, uint64_t microseconds);
+static void librif_budget_update(float *rate, size_t bytes, uint64_t elapsed);
+static bool librif_read_budget_base(RIF_Image *image, RIF_CImage *cimage, uint32_t microseconds, bool *closed);
 
-static uint8_t rif_byte_1_buffer[1];
-static uint8_t rif_byte_4_buffer[4];
+#ifndef RIF_PLAYDATE
+static uint8_t* librif_map_file(const char *filename, size_t minSize, size_t *mapSize);
+static RIF_Image* librif_image_open_in_place(uint8_t *data, size_t size);
+static RIF_CImage* librif_cimage_open_in_place(uint8_t *data, size_t size);
+#endif
+
+static uint32_t librif_uint32_from_bytes(const uint8_t *bytes);
+static void librif_uint32_to_bytes(uint32_t value, uint8_t *bytes);
 
-static RIF_Image* librif_image_base(void);
+static RIF_Image* librif_image_base(RIF_Pool *pool);
+static RIF_Image* librif_image_open_io_base(RIF_IO io, RIF_Pool *pool);
+static RIF_CImage* librif_cimage_open_io_base(RIF_IO io, RIF_Pool *pool);
+static RIF_CImage* librif_cimage_base(RIF_Pool *pool);
+static void librif_image_discard(RIF_Image *image, RIF_PoolMark mark);
+static void librif_cimage_discard(RIF_CImage *image, RIF_PoolMark mark);
 
 static size_t get_pixels_size_in_bytes(int width, int height, bool alpha);
 
-static void librif_cimage_read_patterns(RIF_CImage *image, size_t size);
-static void librif_cimage_read_cells(RIF_CImage *image, size_t size);
+static void librif_image_select_get_pixel(RIF_Image *image);
+static void librif_cimage_select_get_pixel(RIF_CImage *image);
+
+static void librif_copy_row(const uint8_t *src, bool hasAlpha, uint8_t *dst, RIF_PixelFormat format, int count);
+static void librif_fill_row(uint8_t *dst, RIF_PixelFormat format, int count);
+static bool librif_clip_row(int x, int width, int imageWidth, int *left, int *count, int *right);
+
+static int librif_dither_matrix_size(RIF_DitherMethod method);
+static uint8_t librif_bayer_threshold(int x, int y, int matrixSize);
+static void librif_split_row(const uint8_t *src, uint8_t *colors, uint8_t *alphas, int count);
+static void librif_dither_pack_row(const uint8_t *values, const uint8_t *thresholds, uint8_t *dst, int count);
+static void librif_dither_fill_row(uint8_t *dst, bool value, int count);
+static void librif_dither_diffuse_row(const uint8_t *colors, int16_t *errors[3], RIF_DitherMethod method, uint8_t *dst, int count);
+static bool librif_dither_base(RIF_Image *image, RIF_CImage *cimage, RIF_Rect rect, RIF_DitherMethod method, uint8_t *dst, size_t dstStride, uint8_t *mask, size_t maskStride);
+static void librif_dither_rows(RIF_Image *image, RIF_CImage *cimage, RIF_Rect rect, RIF_DitherMethod method, uint8_t *buffer, int16_t *errors[3], uint8_t *dst, size_t dstStride, uint8_t *mask, size_t maskStride);
+static bool librif_cimage_dither_cells(RIF_CImage *image, const uint8_t *blocks, bool fillValue, RIF_Rect rect, uint8_t *dst, size_t dstStride);
+
+static void librif_sample_affine_row_base(RIF_Image *image, RIF_CImage *cimage, int32_t u, int32_t v, int32_t du, int32_t dv, int count, RIF_WrapMode wrapMode, RIF_Filter filter, uint8_t *out, RIF_PixelFormat format);
+
+static bool librif_cimage_read_patterns(RIF_CImage *image, size_t size);
+static bool librif_cimage_read_cells(RIF_CImage *image, size_t size);
+
+static unsigned int librif_cell_index_size_from_flags(uint8_t flags);
+static uint8_t librif_cell_index_flags(unsigned int cellIndexSize);
+static unsigned int librif_cell_index_size(unsigned int numberOfPatterns);
+static void librif_narrow_cells(uint8_t *cells, unsigned int cellIndexSize, const uint8_t *indexes, unsigned int fileCellIndexSize, int count);
+static bool librif_cimage_check_header(uint32_t width, uint32_t height, uint32_t cx, uint32_t cy, uint32_t patternSize, uint32_t numberOfPatterns, bool hasAlpha, unsigned int fileCellIndexSize, size_t availableBytes);
+static bool librif_check_cell_indexes(const uint8_t *indexes, unsigned int cellIndexSize, size_t numberOfCells, unsigned int numberOfPatterns);
+static bool librif_check_cells(const uint8_t *cells, unsigned int cellIndexSize, int count, unsigned int numberOfPatterns);
+
+static RIF_Image* librif_cimage_decompress_base(RIF_CImage *cimage, RIF_Pool *pool);
+
+static size_t librif_compress_with_size(RIF_Image *source, unsigned int patternSize, size_t limit, RIF_CImage *output);
+static void librif_cimage_decompress_rows(RIF_CImage *cimage, RIF_Image *image, unsigned int startRow, unsigned int endRow);
+static RIF_Image* librif_cimage_open_decompressed_io_base(RIF_IO io, RIF_Pool *pool);
+static bool librif_cimage_stream_cells(RIF_CImage *cimage, RIF_Image *image);
+static inline void librif_copy_pattern_rows(uint8_t *dst, size_t dstStride, const uint8_t *src, size_t srcStride, size_t rowSize, int rows);
 
 static void* librif_malloc(size_t size);
 static void* librif_realloc(void *ptr, size_t size);
 static void librif_free(void *ptr);
 
+typedef void (*RIF_DecodeCellsFunction)(uint8_t *cells, const uint8_t *indexes, int count);
+
+static void librif_decode_cells16_scalar(uint8_t *cells, const uint8_t *indexes, int count);
+static void librif_decode_cells32_scalar(uint8_t *cells, const uint8_t *indexes, int count);
+
+#ifdef RIF_SIMD_X86
+static void librif_decode_cells16_sse2(uint8_t *cells, const uint8_t *indexes, int count);
+static void librif_decode_cells32_sse2(uint8_t *cells, const uint8_t *indexes, int count);
+static void librif_decode_cells16_avx2(uint8_t *cells, const uint8_t *indexes, int count);
+static void librif_decode_cells32_avx2(uint8_t *cells, const uint8_t *indexes, int count);
+#endif
+
+#ifdef RIF_SIMD_NEON
+static void librif_decode_cells16_neon(uint8_t *cells, const uint8_t *indexes, int count);
+static void librif_decode_cells32_neon(uint8_t *cells, const uint8_t *indexes, int count);
+#endif
+
+#ifdef RIF_TEST
+// test-only, exported when built with RIF_TEST, false if a SIMD decoder doesn't match the scalar one
+bool librif_check_decode(void);
+static bool librif_check_decode_function(RIF_DecodeCellsFunction function, RIF_DecodeCellsFunction scalar, unsigned int cellIndexSize);
+#endif
+
+static RIF_DecodeCellsFunction librif_decode_cells16 = librif_decode_cells16_scalar;
+static RIF_DecodeCellsFunction librif_decode_cells32 = librif_decode_cells32_scalar;
+
+// nearest samples with hardware gathers, returns the number of samples written
+typedef int (*RIF_SampleGatherFunction)(RIF_Image *image, RIF_CImage *cimage, int32_t u, int32_t v, int32_t du, int32_t dv, int count, RIF_WrapMode wrapMode, uint8_t *out, RIF_PixelFormat format);
+
+#ifdef RIF_SIMD_X86
+static int librif_sample_gather_avx2(RIF_Image *image, RIF_CImage *cimage, int32_t u, int32_t v, int32_t du, int32_t dv, int count, RIF_WrapMode wrapMode, uint8_t *out, RIF_PixelFormat format);
+#endif
+
+static RIF_SampleGatherFunction librif_sample_gather = NULL;
+
 static void librif_init_base(void){
     
+    #if defined(RIF_SIMD_X86)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        librif_decode_cells16 = librif_decode_cells16_avx2;
+        librif_decode_cells32 = librif_decode_cells32_avx2;
+        librif_sample_gather = librif_sample_gather_avx2;
+    }
+    else {
+        librif_decode_cells16 = librif_decode_cells16_sse2;
+        librif_decode_cells32 = librif_decode_cells32_sse2;
+    }
+    #elif defined(RIF_SIMD_NEON)
+    librif_decode_cells16 = librif_decode_cells16_neon;
+    librif_decode_cells32 = librif_decode_cells32_neon;
+    #endif
 }
 
 #ifdef RIF_PLAYDATE
@@ -49,26 +200,37 @@ void librif_init(void){
 }
 #endif
 
-static RIF_Image* librif_image_base(void){
+// the descriptor is allocated in pool if not NULL, returns NULL if the pool is full
+static RIF_Image* librif_image_base(RIF_Pool *pool){
 
-    RIF_Image *image = librif_malloc(sizeof(RIF_Image));
+    RIF_Image *image = (pool != NULL) ? librif_pool_alloc(pool, sizeof(RIF_Image)) : librif_malloc(sizeof(RIF_Image));
+    if(image == NULL){
+        return NULL;
+    }
     
-    image->pool = NULL;
+    image->pool = pool;
     
     image->width = 0;
     image->height = 0;
     
     image->readBytes = 0;
     image->totalBytes = 0;
+    image->budgetRate = 0;
     
     image->hasAlpha = false;
     
     image->pixels = NULL;
     
-    #ifdef RIF_PLAYDATE
-    image->pd_file = NULL;
-    #else
-    image->file = NULL;
+    image->getPixel = librif_image_get_pixel_generic;
+    
+    memset(&image->io, 0, sizeof(RIF_IO));
+    image->hasIO = false;
+    
+    #ifndef RIF_PLAYDATE
+    image->inPlace = false;
+    image->readOnly = false;
+    image->mapAddress = NULL;
+    image->mapSize = 0;
     #endif
     
     return image;
@@ -76,48 +238,195 @@ static RIF_Image* librif_image_base(void){
 
 RIF_Image* librif_image_open(const char *filename, RIF_Pool *pool){
     
-    #ifdef RIF_PLAYDATE
-    SDFile *file = RIF_pd->file->open(filename, kFileRead);
-    if(file == NULL){
-        return NULL;
+    RIF_TRACE_BEGIN(RIF_TraceImageOpen);
+    
+    RIF_Image *image = NULL;
+    
+    RIF_IO io;
+    if(librif_io_file(&io, filename)){
+        image = librif_image_open_io_base(io, pool);
     }
-    #else
-    FILE *file = fopen(filename, "rb");
-    if(file == NULL){
+    
+    RIF_TRACE_END(image ? headerSizeInBytes : 0);
+    return image;
+}
+
+RIF_Image* librif_image_open_io(RIF_IO io, RIF_Pool *pool){
+    
+    RIF_TRACE_BEGIN(RIF_TraceImageOpen);
+    RIF_Image *image = librif_image_open_io_base(io, pool);
+    RIF_TRACE_END(image ? headerSizeInBytes : 0);
+    
+    return image;
+}
+
+static RIF_Image* librif_image_open_io_base(RIF_IO io, RIF_Pool *pool){
+    
+    if(!librif_io_begin(&io, headerSizeInBytes)){
         return NULL;
     }
-    #endif
 
-    RIF_Image *image = librif_image_base();
-    image->pool = pool;
+    RIF_PoolMark mark = (pool != NULL) ? librif_pool_mark(pool) : 0;
     
-    #ifdef RIF_PLAYDATE
-    image->pd_file = file;
-    #else
-    image->file = file;
-    #endif
+    RIF_Image *image = librif_image_base(pool);
+    if(image == NULL){
+        if(io.close != NULL){
+            io.close(io.context);
+        }
+        return NULL;
+    }
+    
+    image->io = io;
+    image->hasIO = true;
+    
+    uint8_t alphaChannelInt;
+    uint32_t width, height;
+    
+    if(!librif_read_uint8(image, &alphaChannelInt) || !librif_read_uint32(image, &width) || !librif_read_uint32(image, &height)){
+        librif_image_discard(image, mark);
+        return NULL;
+    }
+    
+    if(width > INT32_MAX || height > INT32_MAX){
+        librif_image_discard(image, mark);
+        return NULL;
+    }
     
-    uint8_t alphaChannelInt = librif_read_uint8(image);
     image->hasAlpha = (alphaChannelInt == 1) ? true : false;
+    librif_image_select_get_pixel(image);
 
-    image->width = librif_read_uint32(image);
-    image->height = librif_read_uint32(image);
+    image->width = width;
+    image->height = height;
     
     size_t pixelsSizeInBytes = get_pixels_size_in_bytes(image->width, image->height, image->hasAlpha);
     
+    if(!librif_io_has_bytes(&io, headerSizeInBytes + pixelsSizeInBytes)){
+        librif_image_discard(image, mark);
+        return NULL;
+    }
+    
     image->readBytes = 0;
     image->totalBytes = pixelsSizeInBytes;
 
     if(pool != NULL){
-        image->pixels = pool->address;
-        pool->address += pixelsSizeInBytes;
+        image->pixels = librif_pool_alloc(pool, pixelsSizeInBytes);
+        if(image->pixels == NULL){
+            librif_image_discard(image, mark);
+            return NULL;
+        }
     }
     else {
         image->pixels = librif_malloc(pixelsSizeInBytes);
+        if(image->pixels == NULL){
+            librif_image_discard(image, mark);
+            return NULL;
+        }
+    }
+    
+    return image;
+}
+
+#ifndef RIF_PLAYDATE
+static uint8_t* librif_map_file(const char *filename, size_t minSize, size_t *mapSize){
+    
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+    
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t)minSize){
+        close(fd);
+        return NULL;
+    }
+    
+    size_t size = fileStat.st_size;
+    
+    // private writable mapping, pages are shared until they are written
+    void *mapAddress = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    
+    if(mapAddress == MAP_FAILED){
+        return NULL;
+    }
+    
+    *mapSize = size;
+    return mapAddress;
+}
+
+RIF_Image* librif_image_open_mapped(const char *filename){
+    
+    size_t mapSize;
+    uint8_t *header = librif_map_file(filename, headerSizeInBytes, &mapSize);
+    if(header == NULL){
+        return NULL;
+    }
+    
+    RIF_Image *image = librif_image_open_in_place(header, mapSize);
+    if(image == NULL){
+        munmap(header, mapSize);
+        return NULL;
+    }
+    
+    image->mapAddress = header;
+    image->mapSize = mapSize;
+    
+    return image;
+}
+
+RIF_Image* librif_image_open_memory(const void *data, size_t size){
+    
+    // the caller's buffer can be read-only memory, the cast is safe because set_pixel skips it
+    RIF_Image *image = librif_image_open_in_place((uint8_t*)data, size);
+    if(image != NULL){
+        image->readOnly = true;
+    }
+    
+    return image;
+}
+
+// pixels point into data, which must outlive the image
+static RIF_Image* librif_image_open_in_place(uint8_t *data, size_t size){
+    
+    if(size < headerSizeInBytes){
+        return NULL;
+    }
+    
+    bool hasAlpha = (data[0] == 1) ? true : false;
+    uint32_t width = librif_uint32_from_bytes(&data[1]);
+    uint32_t height = librif_uint32_from_bytes(&data[5]);
+    
+    // the file isn't trusted, the pixel count is bounded by the data before it's multiplied
+    if(width > INT32_MAX || height > INT32_MAX){
+        return NULL;
+    }
+    
+    size_t availablePixels = (size - headerSizeInBytes) / (hasAlpha ? 2 : 1);
+    if(height != 0 && width > availablePixels / height){
+        return NULL;
+    }
+    
+    size_t pixelsSizeInBytes = get_pixels_size_in_bytes(width, height, hasAlpha);
+    
+    RIF_Image *image = librif_image_base(NULL);
+    if(image == NULL){
+        return NULL;
     }
     
+    image->hasAlpha = hasAlpha;
+    image->width = width;
+    image->height = height;
+    librif_image_select_get_pixel(image);
+    
+    image->pixels = &data[headerSizeInBytes];
+    image->inPlace = true;
+    
+    image->readBytes = pixelsSizeInBytes;
+    image->totalBytes = pixelsSizeInBytes;
+    
     return image;
 }
+#endif
 
 bool librif_image_read(RIF_Image *image, size_t size, bool *closed){
     
@@ -125,6 +434,14 @@ bool librif_image_read(RIF_Image *image, size_t size, bool *closed){
         *closed = false;
     }
     
+    if(!image->hasIO){
+        // already read or mapped, false if a short read closed the source
+        if(closed != NULL){
+            *closed = true;
+        }
+        return image->readBytes >= image->totalBytes;
+    }
+    
     bool closeFile = false;
     
     size_t chunks = image->totalBytes;
@@ -137,34 +454,42 @@ bool librif_image_read(RIF_Image *image, size_t size, bool *closed){
         closeFile = true;
     }
     
+    RIF_TRACE_BEGIN(RIF_TraceImageRead);
+    
     void *buffer = &image->pixels[image->readBytes];
     
-    #ifdef RIF_PLAYDATE
-    RIF_pd->file->read(image->pd_file, buffer, (unsigned int)chunks);
-    #else
-    fread(buffer, 1, chunks, image->file);
-    #endif
+    size_t readSize = librif_io_read(&image->io, buffer, chunks);
     
-    image->readBytes += chunks;
+    image->readBytes += readSize;
+    
+    RIF_TRACE_END(readSize);
+    
+    if(readSize < chunks){
+        // the source ended before the pixels
+        librif_io_close(&image->io, &image->hasIO);
+        return false;
+    }
 
     if(closeFile){
         if(closed != NULL){
             *closed = true;
         }
                 
-        #ifdef RIF_PLAYDATE
-        RIF_pd->file->close(image->pd_file);
-        image->pd_file = NULL;
-        #else
-        fclose(image->file);
-        image->file = NULL;
-        #endif
+        librif_io_close(&image->io, &image->hasIO);
     }
     
     return true;
 }
 
+bool librif_image_read_budget(RIF_Image *image, uint32_t microseconds, bool *closed){
+    return librif_read_budget_base(image, NULL, microseconds, closed);
+}
+
 void librif_image_get_pixel(RIF_Image *image, int x, int y, uint8_t *color, uint8_t *alpha){
+    image->getPixel(image, x, y, color, alpha);
+}
+
+void librif_image_get_pixel_generic(RIF_Image *image, int x, int y, uint8_t *color, uint8_t *alpha){
 
     if(x < 0 || x >= image->width || y < 0 || y >= image->height){
         *color = 0;
@@ -190,11 +515,47 @@ void librif_image_get_pixel(RIF_Image *image, int x, int y, uint8_t *color, uint
     }
 }
 
+static void librif_image_get_pixel_color(RIF_Image *image, int x, int y, uint8_t *color, uint8_t *alpha){
+    
+    if((unsigned int)x >= (unsigned int)image->width || (unsigned int)y >= (unsigned int)image->height){
+        *color = 0;
+    }
+    else {
+        *color = image->pixels[y * image->width + x];
+    }
+    if(alpha != NULL){
+        *alpha = 255;
+    }
+}
+
+static void librif_image_get_pixel_alpha(RIF_Image *image, int x, int y, uint8_t *color, uint8_t *alpha){
+    
+    if((unsigned int)x >= (unsigned int)image->width || (unsigned int)y >= (unsigned int)image->height){
+        *color = 0;
+        if(alpha != NULL){
+            *alpha = 255;
+        }
+        return;
+    }
+    
+    size_t i = (y * image->width + x) * 2;
+    
+    *color = image->pixels[i];
+    if(alpha != NULL){
+        *alpha = image->pixels[i + 1];
+    }
+}
+
+static void librif_image_select_get_pixel(RIF_Image *image){
+    image->getPixel = image->hasAlpha ? librif_image_get_pixel_alpha : librif_image_get_pixel_color;
+}
+
 RIF_Image* librif_image_new(int width, int height){
     
-    RIF_Image *image = librif_image_base();
+    RIF_Image *image = librif_image_base(NULL);
     
     image->hasAlpha = true;
+    librif_image_select_get_pixel(image);
     
     image->width = width;
     image->height = height;
@@ -202,16 +563,17 @@ RIF_Image* librif_image_new(int width, int height){
     size_t pixelsSizeInBytes = get_pixels_size_in_bytes(image->width, image->height, image->hasAlpha);
     
     image->pixels = librif_malloc(pixelsSizeInBytes);
-    memset(&image->pixels, 0, pixelsSizeInBytes);
+    memset(image->pixels, 0, pixelsSizeInBytes);
     
     return image;
 }
 
 RIF_Image* librif_image_copy(RIF_Image *image){
     
-    RIF_Image *copied = librif_image_base();
+    RIF_Image *copied = librif_image_base(NULL);
     
     copied->hasAlpha = image->hasAlpha;
+    librif_image_select_get_pixel(copied);
     
     copied->width = image->width;
     copied->height = image->height;
@@ -224,6 +586,13 @@ RIF_Image* librif_image_copy(RIF_Image *image){
 }
 
 void librif_image_set_pixel(RIF_Image *image, int x, int y, uint8_t color, uint8_t alpha){
+    
+    #ifndef RIF_PLAYDATE
+    if(image->readOnly){
+        return;
+    }
+    #endif
+    
     if(x >= 0 && x < image->width && y >= 0 && y < image->height){
         
         if(image->hasAlpha){
@@ -238,387 +607,4139 @@ void librif_image_set_pixel(RIF_Image *image, int x, int y, uint8_t color, uint8
     }
 }
 
-RIF_CImage* librif_cimage_open(const char *filename, RIF_Pool *pool){
+static RIF_CImage* librif_cimage_base(RIF_Pool *pool){
     
-    #ifdef RIF_PLAYDATE
-    SDFile *file = RIF_pd->file->open(filename, kFileRead);
-    if(file == NULL){
-        return NULL;
-    }
-    #else
-    FILE *file = fopen(filename, "rb");
-    if(file == NULL){
+    RIF_CImage *image = (pool != NULL) ? librif_pool_alloc(pool, sizeof(RIF_CImage)) : librif_malloc(sizeof(RIF_CImage));
+    if(image == NULL){
         return NULL;
     }
-    #endif
     
-    RIF_CImage *image = librif_malloc(sizeof(RIF_CImage));
     image->pool = pool;
     
-    #ifdef RIF_PLAYDATE
-    image->pd_file = file;
-    #else
-    image->file = file;
-    #endif
+    image->width = 0;
+    image->height = 0;
     
-    uint8_t alphaChannelInt = librifc_read_uint8(image);
-    image->hasAlpha = (alphaChannelInt == 1) ? true : false;
-
-    image->width = librifc_read_uint32(image);
-    image->height = librifc_read_uint32(image);
-
-    unsigned int cx = librifc_read_uint32(image);
-    unsigned int cy = librifc_read_uint32(image);
-
-    image->cellCols = cx;
-    image->cellRows = cy;
-
-    unsigned int patternSize = librifc_read_uint32(image);
-    image->patternSize = patternSize;
-
-    unsigned int numberOfCells = cx * cy;
-    image->numberOfCells = numberOfCells;
-
-    unsigned int numberOfPatterns = librifc_read_uint32(image);
-    image->numberOfPatterns = numberOfPatterns;
-
-    size_t pixelsSizeInBytes = get_pixels_size_in_bytes(image->patternSize, image->patternSize, image->hasAlpha);
-
-    size_t cellsSizeInBytes = numberOfCells * sizeof(uint8_t*);
-    size_t patternsSizeInBytes = numberOfPatterns * pixelsSizeInBytes;
+    image->hasAlpha = false;
+    
+    image->patternSize = 0;
+    image->patternShift = 0;
+    image->numberOfPatterns = 0;
+    image->cellCols = 0;
+    image->cellRows = 0;
+    image->numberOfCells = 0;
+    image->cellIndexSize = 0;
+    image->fileCellIndexSize = 0;
+    
+    image->getPixel = librif_cimage_get_pixel_generic;
     
     image->readBytes = 0;
-    image->totalBytes = patternsSizeInBytes + numberOfCells * patternIndexInBytes;
+    image->totalBytes = 0;
     
     image->patternsReadBytes = 0;
-    image->patternsTotalBytes = patternsSizeInBytes;
+    image->patternsTotalBytes = 0;
+    
+    image->patternsBudgetRate = 0;
+    image->cellsBudgetRate = 0;
     
     image->cellsRead = 0;
     
     image->patterns = NULL;
     image->cells = NULL;
     
-    if(pool != NULL){
-        image->cells = (uint8_t**)pool->address;
-        pool->address += cellsSizeInBytes;
-        
-        image->patterns = pool->address;
-        pool->address += patternsSizeInBytes;
-    }
-    else {
-        image->cells = librif_malloc(cellsSizeInBytes);
-        image->patterns = librif_malloc(patternsSizeInBytes);
-    }
-        
+    image->ditheredPatterns = NULL;
+    image->ditheredMasks = NULL;
+    image->ditherMethod = RIF_DitherThreshold;
+    
+    memset(&image->io, 0, sizeof(RIF_IO));
+    image->hasIO = false;
+    
+    #ifndef RIF_PLAYDATE
+    image->cellIndexes = NULL;
+    
+    image->inPlace = false;
+    
+    image->mapAddress = NULL;
+    image->mapSize = 0;
+    #endif
+    
     return image;
 }
 
-bool librif_cimage_read(RIF_CImage *image, size_t size, bool *closed){
+void librif_image_copy_rect(RIF_Image *image, int x, int y, int width, int height, uint8_t *dst, size_t dstStride, RIF_PixelFormat format){
     
-    if(closed != NULL){
-        *closed = false;
-    }
+    int left, count, right;
+    bool visible = librif_clip_row(x, width, image->width, &left, &count, &right);
     
-    bool closeFile = false;
+    size_t pixelSize = image->hasAlpha ? 2 : 1;
+    size_t dstPixelSize = (format == RIF_PixelFormatColorAlpha) ? 2 : 1;
     
-    if(size > 0){
-        if(image->patternsReadBytes < image->patternsTotalBytes){
-            librif_cimage_read_patterns(image, size);
+    for(int j = 0; j < height; j++){
+        int imageY = y + j;
+        
+        if(!visible || imageY < 0 || imageY >= image->height){
+            librif_fill_row(dst, format, width);
         }
-        else if(image->cellsRead < image->numberOfCells){
-            librif_cimage_read_cells(image, size);
+        else {
+            librif_fill_row(dst, format, left);
+            librif_copy_row(&image->pixels[((size_t)imageY * image->width + x + left) * pixelSize], image->hasAlpha, &dst[left * dstPixelSize], format, count);
+            librif_fill_row(&dst[(left + count) * dstPixelSize], format, right);
         }
         
-        if(image->cellsRead >= image->numberOfCells){
-            closeFile = true;
-        }
-    }
-    else {
-        librif_cimage_read_patterns(image, 0);
-        librif_cimage_read_cells(image, 0);
-        
-        closeFile = true;
+        dst += dstStride;
     }
+}
+
+// splits a row in pixels before the image (left), inside (count) and after (right)
+static bool librif_clip_row(int x, int width, int imageWidth, int *left, int *count, int *right){
     
-    if(closeFile){
-        if(closed != NULL){
-            *closed = true;
-        }
-        
-        #ifdef RIF_PLAYDATE
-        RIF_pd->file->close(image->pd_file);
-        image->pd_file = NULL;
-        #else
-        fclose(image->file);
-        image->file = NULL;
-        #endif
+    int x0 = x < 0 ? 0 : x;
+    int x1 = (x + width) > imageWidth ? imageWidth : (x + width);
+    
+    if(x0 >= x1){
+        *left = width;
+        *count = 0;
+        *right = 0;
+        return false;
     }
     
+    *left = x0 - x;
+    *count = x1 - x0;
+    *right = (x + width) - x1;
+    
     return true;
 }
 
-void librif_cimage_get_pixel(RIF_CImage *image, int x, int y, uint8_t *color, uint8_t *alpha) {
-
-    if(x < 0 || x >= image->width || y < 0 || y >= image->height){
-        *color = 0;
-        if(alpha != NULL){
-            *alpha = 255;
+static void librif_fill_row(uint8_t *dst, RIF_PixelFormat format, int count){
+    
+    // same value returned by get_pixel outside the image
+    if(format == RIF_PixelFormatColorAlpha){
+        for(int i = 0; i < count; i++){
+            dst[i * 2] = 0;
+            dst[i * 2 + 1] = 255;
         }
-        return;
     }
+    else if(count > 0){
+        memset(dst, 0, count);
+    }
+}
 
-    int patternSize = image->patternSize;
-
-    int cellCol = x / patternSize;
-    int cellRow = y / patternSize;
-
-    int patternX = x - cellCol * patternSize;
-    int patternY = y - cellRow * patternSize;
-
-    int cell_i = cellRow * image->cellCols + cellCol;
-    uint8_t *pattern = image->cells[cell_i];
+static void librif_copy_row(const uint8_t *src, bool hasAlpha, uint8_t *dst, RIF_PixelFormat format, int count){
     
-    if(image->hasAlpha){
-        size_t pixel_i = (patternY * patternSize + patternX) * 2;
-        *color = pattern[pixel_i];
-        if(alpha != NULL){
-            *alpha = pattern[pixel_i + 1];
+    if(hasAlpha == (format == RIF_PixelFormatColorAlpha)){
+        memcpy(dst, src, count * (hasAlpha ? 2 : 1));
+        return;
+    }
+    
+    int i = 0;
+    
+    if(hasAlpha){
+        // drop alpha
+        #if defined(RIF_SIMD_X86)
+        __m128i mask = _mm_set1_epi16(0x00FF);
+        for(; i + 16 <= count; i += 16){
+            __m128i lo = _mm_and_si128(_mm_loadu_si128((const __m128i*)&src[i * 2]), mask);
+            __m128i hi = _mm_and_si128(_mm_loadu_si128((const __m128i*)&src[i * 2 + 16]), mask);
+            _mm_storeu_si128((__m128i*)&dst[i], _mm_packus_epi16(lo, hi));
+        }
+        #elif defined(RIF_SIMD_NEON)
+        for(; i + 16 <= count; i += 16){
+            vst1q_u8(&dst[i], vld2q_u8(&src[i * 2]).val[0]);
+        }
+        #endif
+        for(; i < count; i++){
+            dst[i] = src[i * 2];
         }
     }
     else {
-        size_t pixel_i = patternY * patternSize + patternX;
-        *color = pattern[pixel_i];
-        if(alpha != NULL){
-            *alpha = 255;
+        // add opaque alpha
+        #if defined(RIF_SIMD_X86)
+        __m128i opaque = _mm_set1_epi8((char)0xFF);
+        for(; i + 16 <= count; i += 16){
+            __m128i v = _mm_loadu_si128((const __m128i*)&src[i]);
+            _mm_storeu_si128((__m128i*)&dst[i * 2], _mm_unpacklo_epi8(v, opaque));
+            _mm_storeu_si128((__m128i*)&dst[i * 2 + 16], _mm_unpackhi_epi8(v, opaque));
+        }
+        #elif defined(RIF_SIMD_NEON)
+        for(; i + 16 <= count; i += 16){
+            uint8x16x2_t v = { { vld1q_u8(&src[i]), vdupq_n_u8(0xFF) } };
+            vst2q_u8(&dst[i * 2], v);
+        }
+        #endif
+        for(; i < count; i++){
+            dst[i * 2] = src[i];
+            dst[i * 2 + 1] = 255;
         }
     }
 }
 
-static void librif_cimage_read_patterns(RIF_CImage *image, size_t size){
-        
-    size_t chunks = image->patternsTotalBytes;
-    if(size > 0){
-        chunks = size;
-    }
-    
-    if((image->patternsReadBytes + chunks) >= image->patternsTotalBytes){
-        chunks = image->patternsTotalBytes - image->patternsReadBytes;
-    }
-    
-    void *buffer = &image->patterns[image->patternsReadBytes];
-
-    #ifdef RIF_PLAYDATE
-    RIF_pd->file->read(image->pd_file, buffer, (unsigned int)chunks);
-    #else
-    fread(buffer, 1, chunks, image->file);
-    #endif
-    
-    image->patternsReadBytes += chunks;
-    image->readBytes += chunks;
+bool librif_image_dither(RIF_Image *image, RIF_Rect rect, RIF_DitherMethod method, uint8_t *dst, size_t dstStride, uint8_t *mask, size_t maskStride){
+    return librif_dither_base(image, NULL, rect, method, dst, dstStride, mask, maskStride);
 }
 
-static void librif_cimage_read_cells(RIF_CImage *image, size_t size){
+void librif_image_sample_affine_row(RIF_Image *image, int32_t u0, int32_t v0, int32_t du, int32_t dv, int count, RIF_WrapMode wrapMode, RIF_Filter filter, uint8_t *out, RIF_PixelFormat format){
+    librif_sample_affine_row_base(image, NULL, u0, v0, du, dv, count, wrapMode, filter, out, format);
+}
 
-    int chunks = image->numberOfCells;
-    if(size > 0){
-        chunks = fmaxf(1, (float)size / patternIndexInBytes);
-    }
+// dithers an image or a cimage, rows of a cimage are fetched with copy_rect
+static bool librif_dither_base(RIF_Image *image, RIF_CImage *cimage, RIF_Rect rect, RIF_DitherMethod method, uint8_t *dst, size_t dstStride, uint8_t *mask, size_t maskStride){
     
-    if((image->cellsRead + chunks) >= image->numberOfCells){
-        chunks = image->numberOfCells - image->cellsRead;
+    if(rect.width <= 0 || rect.height <= 0){
+        return true;
     }
-
-    size_t bufferSize = chunks * patternIndexInBytes;
-    void *buffer = librif_malloc(bufferSize);
     
-    #ifdef RIF_PLAYDATE
-    RIF_pd->file->read(image->pd_file, buffer, (unsigned int)bufferSize);
-    #else
-    fread(buffer, patternIndexInBytes, chunks, image->file);
-    #endif
+    bool diffusion = (method == RIF_DitherFloydSteinberg || method == RIF_DitherAtkinson);
     
-    size_t pixelsSizeInBytes = get_pixels_size_in_bytes(image->patternSize, image->patternSize, image->hasAlpha);
-    int endRead = image->cellsRead + chunks;
+    // colors, alphas, a row of 128 for the mask, one threshold row per matrix row, a row of interleaved pixels
+    size_t columnSize = 5 + librif_dither_matrix_size(method);
+    
+    // int16_t keeps the error rows aligned
+    int16_t stackBuffer[RIF_DITHER_BUFFER_SIZE / sizeof(int16_t)];
+    uint8_t *buffer = (uint8_t*)stackBuffer;
+    
+    if(!diffusion){
+        // thresholds only depend on image coordinates, so wide rects are dithered in strips of whole bytes
+        int stripWidth = (RIF_DITHER_BUFFER_SIZE / columnSize) & ~7;
         
-    uint8_t *bufferPtr = buffer;
+        for(int x = 0; x < rect.width; x += stripWidth){
+            RIF_Rect strip = rect;
+            strip.x = rect.x + x;
+            strip.width = (rect.width - x) < stripWidth ? (rect.width - x) : stripWidth;
+            
+            librif_dither_rows(image, cimage, strip, method, buffer, NULL, &dst[x >> 3], dstStride, (mask != NULL) ? &mask[x >> 3] : NULL, maskStride);
+        }
+        return true;
+    }
     
-    for(int i = image->cellsRead; i < endRead; i++){
-        uint32_t patternIndex = bufferPtr[0] << 24 | bufferPtr[1] << 16 | bufferPtr[2] << 8 | bufferPtr[3];
-        image->cells[i] = &image->patterns[patternIndex * pixelsSizeInBytes];
-        bufferPtr += patternIndexInBytes;
+    // errors are carried along the whole row, two columns of padding on both sides
+    size_t errorRowSize = rect.width + 4;
+    size_t errorsSize = errorRowSize * 3 * sizeof(int16_t);
+    size_t bufferSize = errorsSize + rect.width * columnSize;
+    
+    if(bufferSize > RIF_DITHER_BUFFER_SIZE){
+        buffer = librif_malloc(bufferSize);
+        if(buffer == NULL){
+            return false;
+        }
+    }
+    
+    int16_t *errorRows = (int16_t*)buffer;
+    memset(errorRows, 0, errorsSize);
+    
+    int16_t *errors[3];
+    for(int i = 0; i < 3; i++){
+        errors[i] = &errorRows[errorRowSize * i + 2];
     }
     
-    librif_free(buffer);
+    librif_dither_rows(image, cimage, rect, method, &buffer[errorsSize], errors, dst, dstStride, mask, maskStride);
+    
+    if(buffer != (uint8_t*)stackBuffer){
+        librif_free(buffer);
+    }
     
-    image->cellsRead += chunks;
-    image->readBytes += bufferSize;
+    return true;
 }
 
-RIF_Image* librif_cimage_decompress(RIF_CImage *cimage, RIF_Pool *pool){
+// buffer holds columnSize bytes per column of rect, errors is NULL for ordered dithering
+static void librif_dither_rows(RIF_Image *image, RIF_CImage *cimage, RIF_Rect rect, RIF_DitherMethod method, uint8_t *buffer, int16_t *errors[3], uint8_t *dst, size_t dstStride, uint8_t *mask, size_t maskStride){
     
-    RIF_Image *image = librif_image_base();
-    image->pool = pool;
+    int width = rect.width;
     
-    image->readBytes = 0;
-    image->totalBytes = 0;
+    int imageWidth = (image != NULL) ? image->width : cimage->width;
+    int imageHeight = (image != NULL) ? image->height : cimage->height;
+    bool hasAlpha = (image != NULL) ? image->hasAlpha : cimage->hasAlpha;
     
-    image->width = cimage->width;
-    image->height = cimage->height;
-    image->hasAlpha = cimage->hasAlpha;
+    int left, count, right;
+    bool visible = librif_clip_row(rect.x, width, imageWidth, &left, &count, &right);
     
-    size_t pixelsSizeInBytes = get_pixels_size_in_bytes(image->width, image->height, image->hasAlpha);
+    bool diffusion = (errors != NULL);
+    int matrixSize = librif_dither_matrix_size(method);
     
-    if(pool != NULL){
-        image->pixels = pool->address;
-        pool->address += pixelsSizeInBytes;
-    }
-    else {
-        image->pixels = librif_malloc(pixelsSizeInBytes);
+    uint8_t *colors = buffer;
+    uint8_t *alphas = &colors[width];
+    uint8_t *halves = &alphas[width];
+    uint8_t *thresholds = &halves[width];
+    uint8_t *pixels = &thresholds[width * matrixSize];
+    
+    memset(halves, 128, width);
+    
+    // thresholds are anchored to image coordinates, so scrolling doesn't move the pattern
+    int matrixX = ((rect.x % matrixSize) + matrixSize) % matrixSize;
+    for(int j = 0; j < matrixSize; j++){
+        uint8_t *row = &thresholds[j * width];
+        for(int i = 0; i < width && i < matrixSize; i++){
+            row[i] = librif_bayer_threshold((matrixX + i) % matrixSize, j, matrixSize);
+        }
+        for(int i = matrixSize; i < width; i++){
+            row[i] = row[i - matrixSize];
+        }
     }
     
-    for(int y = 0; y < image->height; y++){
-        for(int x = 0; x < image->width; x++){
+    size_t pixelSize = hasAlpha ? 2 : 1;
+    
+    for(int j = 0; j < rect.height; j++){
+        int imageY = rect.y + j;
+        bool rowVisible = visible && imageY >= 0 && imageY < imageHeight;
+        
+        // pixels outside the image are black and opaque
+        memset(colors, 0, width);
+        memset(alphas, 255, width);
+        
+        if(rowVisible){
+            const uint8_t *src = pixels;
+            if(image != NULL){
+                src = &image->pixels[((size_t)imageY * image->width + rect.x + left) * pixelSize];
+            }
+            else {
+                librif_cimage_copy_rect(cimage, rect.x + left, imageY, count, 1, pixels, 0, hasAlpha ? RIF_PixelFormatColorAlpha : RIF_PixelFormatColor);
+            }
             
-            uint8_t color, alpha;
-            librif_cimage_get_pixel(cimage, x, y, &color, &alpha);
-
-            if(image->hasAlpha){
-                size_t i = (y * image->width + x) * 2;
-                image->pixels[i] = color;
-                image->pixels[i + 1] = alpha;
+            if(hasAlpha){
+                librif_split_row(src, &colors[left], &alphas[left], count);
             }
             else {
-                size_t i = y * image->width + x;
-                image->pixels[i] = color;
+                memcpy(&colors[left], src, count);
             }
         }
+        
+        if(diffusion){
+            librif_dither_diffuse_row(colors, errors, method, dst, width);
+        }
+        else {
+            int matrixY = ((imageY % matrixSize) + matrixSize) % matrixSize;
+            librif_dither_pack_row(colors, &thresholds[matrixY * width], dst, width);
+        }
+        
+        if(mask != NULL){
+            if(rowVisible && hasAlpha){
+                librif_dither_pack_row(alphas, halves, mask, width);
+            }
+            else {
+                librif_dither_fill_row(mask, true, width);
+            }
+            mask += maskStride;
+        }
+        
+        dst += dstStride;
     }
-    
-    return image;
 }
 
-static size_t get_pixels_size_in_bytes(int width, int height, bool alpha){
-    size_t numberOfPixels = width * height;
-    size_t size;
-    if(alpha){
-        size = numberOfPixels * sizeof(uint8_t) * 2;
+static int librif_dither_matrix_size(RIF_DitherMethod method){
+    switch(method){
+        case RIF_DitherBayer2:
+            return 2;
+        case RIF_DitherBayer4:
+            return 4;
+        case RIF_DitherBayer8:
+            return 8;
+        default:
+            return 1;
     }
-    else {
-        size = numberOfPixels * sizeof(uint8_t);
+}
+
+// threshold of a Bayer matrix cell, matrixSize 1 is a plain 128 threshold
+static uint8_t librif_bayer_threshold(int x, int y, int matrixSize){
+    
+    static const uint8_t bayer2[2][2] = { { 0, 2 }, { 3, 1 } };
+    
+    // the outer quadrant is the least significant digit
+    int value = 0;
+    int weight = 1;
+    for(int s = matrixSize / 2; s > 0; s /= 2){
+        value += bayer2[(y & s) ? 1 : 0][(x & s) ? 1 : 0] * weight;
+        weight *= 4;
     }
-    return size;
+    
+    // centered in its interval, 0 is always black and 255 always white
+    return (value * 256 + 128) / (matrixSize * matrixSize);
 }
 
-static uint8_t librif_read_uint8(RIF_Image *image){
-    #ifdef RIF_PLAYDATE
-    RIF_pd->file->read(image->pd_file, rif_byte_1_buffer, 1);
-    #else
-    fread(rif_byte_1_buffer, 1, 1, image->file);
+static void librif_split_row(const uint8_t *src, uint8_t *colors, uint8_t *alphas, int count){
+    
+    int i = 0;
+    
+    #if defined(RIF_SIMD_X86)
+    __m128i mask = _mm_set1_epi16(0x00FF);
+    for(; i + 16 <= count; i += 16){
+        __m128i lo = _mm_loadu_si128((const __m128i*)&src[i * 2]);
+        __m128i hi = _mm_loadu_si128((const __m128i*)&src[i * 2 + 16]);
+        _mm_storeu_si128((__m128i*)&colors[i], _mm_packus_epi16(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask)));
+        _mm_storeu_si128((__m128i*)&alphas[i], _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+    #elif defined(RIF_SIMD_NEON)
+    for(; i + 16 <= count; i += 16){
+        uint8x16x2_t v = vld2q_u8(&src[i * 2]);
+        vst1q_u8(&colors[i], v.val[0]);
+        vst1q_u8(&alphas[i], v.val[1]);
+    }
     #endif
-    return rif_byte_1_buffer[0];
+    
+    for(; i < count; i++){
+        colors[i] = src[i * 2];
+        alphas[i] = src[i * 2 + 1];
+    }
 }
 
-static uint32_t librif_read_uint32(RIF_Image *image){
-    #ifdef RIF_PLAYDATE
-    RIF_pd->file->read(image->pd_file, rif_byte_4_buffer, 4);
-    #else
-    fread(rif_byte_4_buffer, 4, 1, image->file);
-    #endif
-    return rif_byte_4_buffer[0] << 24 | rif_byte_4_buffer[1] << 16 | rif_byte_4_buffer[2] << 8 | rif_byte_4_buffer[3];
+#ifdef RIF_SIMD_X86
+// movemask puts the first pixel in the lowest bit, rows are MSB-first
+static inline unsigned int librif_reverse_byte_bits(unsigned int bits){
+    bits = ((bits & 0xF0F0) >> 4) | ((bits & 0x0F0F) << 4);
+    bits = ((bits & 0xCCCC) >> 2) | ((bits & 0x3333) << 2);
+    bits = ((bits & 0xAAAA) >> 1) | ((bits & 0x5555) << 1);
+    return bits;
 }
+#endif
 
-static uint8_t librifc_read_uint8(RIF_CImage *image){
-    #ifdef RIF_PLAYDATE
-    RIF_pd->file->read(image->pd_file, rif_byte_1_buffer, 1);
-    #else
-    fread(rif_byte_1_buffer, 1, 1, image->file);
+// one bit per pixel, set when value >= threshold, MSB-first. Trailing bits of the last byte are cleared
+static void librif_dither_pack_row(const uint8_t *values, const uint8_t *thresholds, uint8_t *dst, int count){
+    
+    int i = 0;
+    
+    #if defined(RIF_SIMD_X86)
+    for(; i + 16 <= count; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)&values[i]);
+        __m128i t = _mm_loadu_si128((const __m128i*)&thresholds[i]);
+        // unsigned v >= t
+        __m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(v, t), v);
+        unsigned int bits = librif_reverse_byte_bits(_mm_movemask_epi8(ge));
+        dst[i >> 3] = bits & 0xFF;
+        dst[(i >> 3) + 1] = bits >> 8;
+    }
+    #elif defined(RIF_SIMD_NEON)
+    static const uint8_t weights[16] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+    uint8x16_t w = vld1q_u8(weights);
+    for(; i + 16 <= count; i += 16){
+        uint8x16_t bits = vandq_u8(vcgeq_u8(vld1q_u8(&values[i]), vld1q_u8(&thresholds[i])), w);
+        bits = vpaddq_u8(bits, bits);
+        bits = vpaddq_u8(bits, bits);
+        bits = vpaddq_u8(bits, bits);
+        dst[i >> 3] = vgetq_lane_u8(bits, 0);
+        dst[(i >> 3) + 1] = vgetq_lane_u8(bits, 1);
+    }
     #endif
-    return rif_byte_1_buffer[0];
+    
+    uint8_t byte = 0;
+    for(; i < count; i++){
+        if(values[i] >= thresholds[i]){
+            byte |= 0x80 >> (i & 7);
+        }
+        if((i & 7) == 7){
+            dst[i >> 3] = byte;
+            byte = 0;
+        }
+    }
+    if(count & 7){
+        dst[count >> 3] = byte;
+    }
 }
 
-static uint32_t librifc_read_uint32(RIF_CImage *image){
-    #ifdef RIF_PLAYDATE
-    RIF_pd->file->read(image->pd_file, rif_byte_4_buffer, 4);
-    #else
-    fread(rif_byte_4_buffer, 4, 1, image->file);
-    #endif
-    return rif_byte_4_buffer[0] << 24 | rif_byte_4_buffer[1] << 16 | rif_byte_4_buffer[2] << 8 | rif_byte_4_buffer[3];
+static void librif_dither_fill_row(uint8_t *dst, bool value, int count){
+    memset(dst, value ? 0xFF : 0x00, count >> 3);
+    if(count & 7){
+        dst[count >> 3] = value ? (uint8_t)(0xFF00 >> (count & 7)) : 0x00;
+    }
 }
 
-void librif_image_free(RIF_Image *image){
+// error diffusion restarts at the edges of the rect, errors[0] is the current row
+static void librif_dither_diffuse_row(const uint8_t *colors, int16_t *errors[3], RIF_DitherMethod method, uint8_t *dst, int count){
     
-    if(image->pool == NULL){
-        librif_free(image->pixels);
+    int16_t *current = errors[0];
+    int16_t *next = errors[1];
+    int16_t *after = errors[2];
+    
+    // errors for the pixels on the right are carried in registers,
+    // below0 and below1 are pending for next[i - 1] and next[i]
+    int right0 = 0;
+    int right1 = 0;
+    int below0 = 0;
+    int below1 = 0;
+    
+    uint8_t byte = 0;
+    
+    for(int i = 0; i < count; i++){
+        int value = colors[i] + current[i] + right0;
+        int white = value >= 128;
+        int error = value - (-white & 255);
+        
+        byte |= white << (7 - (i & 7));
+        
+        if(method == RIF_DitherFloydSteinberg){
+            int downLeft = error * 3 / 16;
+            int down = error * 5 / 16;
+            
+            right0 = error * 7 / 16;
+            int downRight = error - right0 - downLeft - down;
+            
+            next[i - 1] += below0 + downLeft;
+            below0 = below1 + down;
+            below1 = downRight;
+        }
+        else {
+            // Atkinson spreads 6/8 of the error
+            int part = error / 8;
+            
+            right0 = right1 + part;
+            right1 = part;
+            
+            next[i - 1] += below0 + part;
+            below0 = below1 + part;
+            below1 = part;
+            
+            after[i] += part;
+        }
+        
+        if((i & 7) == 7){
+            dst[i >> 3] = byte;
+            byte = 0;
+        }
+    }
+    if(count & 7){
+        dst[count >> 3] = byte;
     }
     
-    librif_free(image);
+    next[count - 1] += below0;
+    
+    // shift rows, the current row becomes the cleared last one
+    memset(current - 2, 0, (count + 4) * sizeof(int16_t));
+    errors[0] = next;
+    errors[1] = after;
+    errors[2] = current;
 }
 
-void librif_cimage_free(RIF_CImage *image){
-	
-    if(image->pool == NULL){
-        librif_free(image->patterns);
-        librif_free(image->cells);
+RIF_CImage* librif_cimage_open(const char *filename, RIF_Pool *pool){
+    
+    RIF_TRACE_BEGIN(RIF_TraceCImageOpen);
+    
+    RIF_CImage *image = NULL;
+    
+    RIF_IO io;
+    if(librif_io_file(&io, filename)){
+        image = librif_cimage_open_io_base(io, pool);
     }
     
-    librif_free(image);
+    RIF_TRACE_END(image ? cheaderSizeInBytes : 0);
+    return image;
 }
 
-RIF_Pool* librif_pool_new(size_t size){
-    void *ptr = librif_malloc(size);
+RIF_CImage* librif_cimage_open_io(RIF_IO io, RIF_Pool *pool){
     
-    RIF_Pool *pool = librif_malloc(sizeof(RIF_Pool));
+    RIF_TRACE_BEGIN(RIF_TraceCImageOpen);
+    RIF_CImage *image = librif_cimage_open_io_base(io, pool);
+    RIF_TRACE_END(image ? cheaderSizeInBytes : 0);
     
-    pool->size = size;
-    pool->startAddress = ptr;
-    pool->address = ptr;
-
-    return pool;
-}
-
-void librif_pool_clear(RIF_Pool *pool){
-    pool->address = pool->startAddress;
-    memset(pool->startAddress, 0, pool->size);
-}
-
-void librif_pool_realloc(RIF_Pool *pool, size_t size){
-    pool->size = size;
-    pool->address = librif_realloc(pool->address, size);
+    return image;
 }
 
-void librif_pool_free(RIF_Pool *pool){
-    librif_pool_clear(pool);
+static RIF_CImage* librif_cimage_open_io_base(RIF_IO io, RIF_Pool *pool){
     
-    librif_free(pool->startAddress);
-    librif_free(pool);
-}
+    if(!librif_io_begin(&io, cheaderSizeInBytes)){
+        return NULL;
+    }
+    
+    RIF_PoolMark mark = (pool != NULL) ? librif_pool_mark(pool) : 0;
+    
+    RIF_CImage *image = librif_cimage_base(pool);
+    if(image == NULL){
+        if(io.close != NULL){
+            io.close(io.context);
+        }
+        return NULL;
+    }
+    
+    image->io = io;
+    image->hasIO = true;
+    
+    uint8_t flags;
+    uint32_t width, height, cx, cy, patternSize, numberOfPatterns;
+    
+    bool success = librifc_read_uint8(image, &flags);
+    success = success && librifc_read_uint32(image, &width) && librifc_read_uint32(image, &height);
+    success = success && librifc_read_uint32(image, &cx) && librifc_read_uint32(image, &cy);
+    success = success && librifc_read_uint32(image, &patternSize) && librifc_read_uint32(image, &numberOfPatterns);
+    
+    if(!success){
+        librif_cimage_discard(image, mark);
+        return NULL;
+    }
+    
+    image->hasAlpha = (flags & alphaFlag) ? true : false;
+    image->fileCellIndexSize = librif_cell_index_size_from_flags(flags);
+    
+    if(!librif_cimage_check_header(width, height, cx, cy, patternSize, numberOfPatterns, image->hasAlpha, image->fileCellIndexSize, SIZE_MAX)){
+        librif_cimage_discard(image, mark);
+        return NULL;
+    }
 
-#ifdef RIF_PLAYDATE
+    image->width = width;
+    image->height = height;
 
-static void* librif_malloc(size_t size){
-    return RIF_pd->system->realloc(NULL, size);
-}
+    image->cellCols = cx;
+    image->cellRows = cy;
 
-static void* librif_realloc(void *ptr, size_t size){
-    return RIF_pd->system->realloc(ptr, size);
-}
+    image->patternSize = patternSize;
+    librif_cimage_select_get_pixel(image);
 
-static void librif_free(void *ptr){
-    RIF_pd->system->realloc(ptr, 0);
-}
+    unsigned int numberOfCells = cx * cy;
+    image->numberOfCells = numberOfCells;
 
-#else
+    image->numberOfPatterns = numberOfPatterns;
 
-static void* librif_malloc(size_t size){
-    return malloc(size);
-}
+    size_t pixelsSizeInBytes = get_pixels_size_in_bytes(image->patternSize, image->patternSize, image->hasAlpha);
 
-static void* librif_realloc(void *ptr, size_t size){
-    return realloc(ptr, size);
-}
+    // cells are kept in memory as pattern indexes with the smallest size that fits,
+    // files written with a larger index size are narrowed while reading
+    image->cellIndexSize = librif_cell_index_size(numberOfPatterns);
+    if(image->cellIndexSize > image->fileCellIndexSize){
+        image->cellIndexSize = image->fileCellIndexSize;
+    }
+    
+    size_t cellsSizeInBytes = (size_t)numberOfCells * image->cellIndexSize;
+    size_t patternsSizeInBytes = numberOfPatterns * pixelsSizeInBytes;
+    
+    image->readBytes = 0;
+    image->totalBytes = patternsSizeInBytes + (size_t)numberOfCells * image->fileCellIndexSize;
+    
+    if(!librif_io_has_bytes(&io, cheaderSizeInBytes + image->totalBytes)){
+        librif_cimage_discard(image, mark);
+        return NULL;
+    }
+    
+    image->patternsReadBytes = 0;
+    image->patternsTotalBytes = patternsSizeInBytes;
+    
+    image->cellsRead = 0;
+    
+    if(pool != NULL){
+        image->cells = librif_pool_alloc(pool, cellsSizeInBytes);
+        image->patterns = librif_pool_alloc(pool, patternsSizeInBytes);
+        
+        if(image->cells == NULL || image->patterns == NULL){
+            librif_cimage_discard(image, mark);
+            return NULL;
+        }
+    }
+    else {
+        image->cells = librif_malloc(cellsSizeInBytes);
+        image->patterns = librif_malloc(patternsSizeInBytes);
+        
+        if(image->cells == NULL || image->patterns == NULL){
+            librif_cimage_discard(image, mark);
+            return NULL;
+        }
+    }
+        
+    return image;
+}
+
+#ifndef RIF_PLAYDATE
+RIF_CImage* librif_cimage_open_mapped(const char *filename){
+    
+    size_t mapSize;
+    uint8_t *header = librif_map_file(filename, cheaderSizeInBytes, &mapSize);
+    if(header == NULL){
+        return NULL;
+    }
+    
+    RIF_CImage *image = librif_cimage_open_in_place(header, mapSize);
+    if(image == NULL){
+        munmap(header, mapSize);
+        return NULL;
+    }
+    
+    image->mapAddress = header;
+    image->mapSize = mapSize;
+    
+    return image;
+}
+
+RIF_CImage* librif_cimage_open_memory(const void *data, size_t size){
+    return librif_cimage_open_in_place((uint8_t*)data, size);
+}
+
+// patterns and indexes point into data, which must outlive the image
+static RIF_CImage* librif_cimage_open_in_place(uint8_t *data, size_t size){
+    
+    if(size < cheaderSizeInBytes){
+        return NULL;
+    }
+    
+    bool hasAlpha = (data[0] & alphaFlag) ? true : false;
+    unsigned int cellIndexSize = librif_cell_index_size_from_flags(data[0]);
+    
+    uint32_t width = librif_uint32_from_bytes(&data[1]);
+    uint32_t height = librif_uint32_from_bytes(&data[5]);
+    
+    uint32_t cx = librif_uint32_from_bytes(&data[9]);
+    uint32_t cy = librif_uint32_from_bytes(&data[13]);
+    
+    uint32_t patternSize = librif_uint32_from_bytes(&data[17]);
+    uint32_t numberOfPatterns = librif_uint32_from_bytes(&data[21]);
+    
+    if(!librif_cimage_check_header(width, height, cx, cy, patternSize, numberOfPatterns, hasAlpha, cellIndexSize, size - cheaderSizeInBytes)){
+        return NULL;
+    }
+    
+    unsigned int numberOfCells = cx * cy;
+    
+    size_t patternsSizeInBytes = numberOfPatterns * get_pixels_size_in_bytes(patternSize, patternSize, hasAlpha);
+    size_t cellsSizeInBytes = (size_t)numberOfCells * cellIndexSize;
+    
+    const uint8_t *cellIndexes = &data[cheaderSizeInBytes + patternsSizeInBytes];
+    
+    // indexes are checked once here, so get_pixel can use them without bounds checks
+    if(!librif_check_cell_indexes(cellIndexes, cellIndexSize, numberOfCells, numberOfPatterns)){
+        return NULL;
+    }
+    
+    RIF_CImage *image = librif_cimage_base(NULL);
+    if(image == NULL){
+        return NULL;
+    }
+    
+    image->hasAlpha = hasAlpha;
+    
+    image->width = width;
+    image->height = height;
+    
+    image->cellCols = cx;
+    image->cellRows = cy;
+    image->patternSize = patternSize;
+    image->numberOfCells = numberOfCells;
+    image->numberOfPatterns = numberOfPatterns;
+    image->cellIndexSize = cellIndexSize;
+    image->fileCellIndexSize = cellIndexSize;
+    librif_cimage_select_get_pixel(image);
+    
+    // patterns and indexes are used in place, cells are resolved on access
+    image->patterns = &data[cheaderSizeInBytes];
+    image->cellIndexes = cellIndexes;
+    image->inPlace = true;
+    
+    image->readBytes = patternsSizeInBytes + cellsSizeInBytes;
+    image->totalBytes = image->readBytes;
+    
+    image->patternsReadBytes = patternsSizeInBytes;
+    image->patternsTotalBytes = patternsSizeInBytes;
+    
+    image->cellsRead = numberOfCells;
+    
+    return image;
+}
+
+#endif
+
+bool librif_cimage_read(RIF_CImage *image, size_t size, bool *closed){
+    
+    if(closed != NULL){
+        *closed = false;
+    }
+    
+    if(!image->hasIO){
+        // already read or mapped, false if a short read closed the source
+        if(closed != NULL){
+            *closed = true;
+        }
+        return image->readBytes >= image->totalBytes;
+    }
+    
+    bool closeFile = false;
+    bool success = true;
+    
+    if(size > 0){
+        if(image->patternsReadBytes < image->patternsTotalBytes){
+            success = librif_cimage_read_patterns(image, size);
+        }
+        else if(image->cellsRead < (int)image->numberOfCells){
+            success = librif_cimage_read_cells(image, size);
+        }
+        
+        if(image->cellsRead >= (int)image->numberOfCells){
+            closeFile = true;
+        }
+    }
+    else {
+        success = librif_cimage_read_patterns(image, 0) && librif_cimage_read_cells(image, 0);
+        
+        closeFile = true;
+    }
+    
+    if(!success){
+        // the source ended before the cells
+        librif_io_close(&image->io, &image->hasIO);
+        return false;
+    }
+    
+    if(closeFile){
+        if(closed != NULL){
+            *closed = true;
+        }
+        
+        librif_io_close(&image->io, &image->hasIO);
+    }
+    
+    return true;
+}
+
+bool librif_cimage_read_budget(RIF_CImage *image, uint32_t microseconds, bool *closed){
+    return librif_read_budget_base(NULL, image, microseconds, closed);
+}
+
+static inline uint32_t librif_cimage_get_pattern_index(RIF_CImage *image, int cell_i){
+    #ifndef RIF_PLAYDATE
+    if(image->cellIndexes != NULL){
+        // big-endian indexes inside the mapped file
+        const uint8_t *bytes = &image->cellIndexes[cell_i * image->cellIndexSize];
+        switch(image->cellIndexSize){
+            case 1:
+                return bytes[0];
+            case 2:
+                return bytes[0] << 8 | bytes[1];
+            default:
+                return librif_uint32_from_bytes(bytes);
+        }
+    }
+    #endif
+    switch(image->cellIndexSize){
+        case 1:
+            return image->cells[cell_i];
+        case 2:
+            return ((uint16_t*)image->cells)[cell_i];
+        default:
+            return ((uint32_t*)image->cells)[cell_i];
+    }
+}
+
+static inline uint8_t* librif_cimage_get_pattern(RIF_CImage *image, int cell_i){
+    size_t pixelsSizeInBytes = get_pixels_size_in_bytes(image->patternSize, image->patternSize, image->hasAlpha);
+    return &image->patterns[librif_cimage_get_pattern_index(image, cell_i) * pixelsSizeInBytes];
+}
+
+void librif_cimage_get_pixel(RIF_CImage *image, int x, int y, uint8_t *color, uint8_t *alpha){
+    image->getPixel(image, x, y, color, alpha);
+}
+
+void librif_cimage_get_pixel_generic(RIF_CImage *image, int x, int y, uint8_t *color, uint8_t *alpha){
+
+    if(x < 0 || x >= image->width || y < 0 || y >= image->height){
+        *color = 0;
+        if(alpha != NULL){
+            *alpha = 255;
+        }
+        return;
+    }
+
+    int patternSize = image->patternSize;
+
+    int cellCol = x / patternSize;
+    int cellRow = y / patternSize;
+
+    int patternX = x - cellCol * patternSize;
+    int patternY = y - cellRow * patternSize;
+
+    int cell_i = cellRow * image->cellCols + cellCol;
+    uint8_t *pattern = librif_cimage_get_pattern(image, cell_i);
+    
+    if(image->hasAlpha){
+        size_t pixel_i = (patternY * patternSize + patternX) * 2;
+        *color = pattern[pixel_i];
+        if(alpha != NULL){
+            *alpha = pattern[pixel_i + 1];
+        }
+    }
+    else {
+        size_t pixel_i = patternY * patternSize + patternX;
+        *color = pattern[pixel_i];
+        if(alpha != NULL){
+            *alpha = 255;
+        }
+    }
+}
+
+// shift and hasAlpha are constants in the specialized accessors below
+static inline void librif_cimage_get_pixel_base(RIF_CImage *image, int x, int y, uint8_t *color, uint8_t *alpha, bool shift, bool hasAlpha){
+    
+    if((unsigned int)x >= (unsigned int)image->width || (unsigned int)y >= (unsigned int)image->height){
+        *color = 0;
+        if(alpha != NULL){
+            *alpha = 255;
+        }
+        return;
+    }
+    
+    unsigned int patternSize = image->patternSize;
+    unsigned int cellCol, cellRow, patternX, patternY;
+    
+    if(shift){
+        cellCol = (unsigned int)x >> image->patternShift;
+        cellRow = (unsigned int)y >> image->patternShift;
+        patternX = x & (patternSize - 1);
+        patternY = y & (patternSize - 1);
+    }
+    else {
+        cellCol = (unsigned int)x / patternSize;
+        cellRow = (unsigned int)y / patternSize;
+        patternX = x - cellCol * patternSize;
+        patternY = y - cellRow * patternSize;
+    }
+    
+    size_t pixelSize = hasAlpha ? 2 : 1;
+    size_t patternBytes = patternSize * patternSize * pixelSize;
+    
+    uint32_t index = librif_cimage_get_pattern_index(image, cellRow * image->cellCols + cellCol);
+    const uint8_t *pixel = &image->patterns[index * patternBytes + (patternY * patternSize + patternX) * pixelSize];
+    
+    *color = pixel[0];
+    if(alpha != NULL){
+        *alpha = hasAlpha ? pixel[1] : 255;
+    }
+}
+
+static void librif_cimage_get_pixel_shift_color(RIF_CImage *image, int x, int y, uint8_t *color, uint8_t *alpha){
+    librif_cimage_get_pixel_base(image, x, y, color, alpha, true, false);
+}
+
+static void librif_cimage_get_pixel_shift_alpha(RIF_CImage *image, int x, int y, uint8_t *color, uint8_t *alpha){
+    librif_cimage_get_pixel_base(image, x, y, color, alpha, true, true);
+}
+
+static void librif_cimage_get_pixel_divide_color(RIF_CImage *image, int x, int y, uint8_t *color, uint8_t *alpha){
+    librif_cimage_get_pixel_base(image, x, y, color, alpha, false, false);
+}
+
+static void librif_cimage_get_pixel_divide_alpha(RIF_CImage *image, int x, int y, uint8_t *color, uint8_t *alpha){
+    librif_cimage_get_pixel_base(image, x, y, color, alpha, false, true);
+}
+
+static void librif_cimage_select_get_pixel(RIF_CImage *image){
+    
+    unsigned int patternSize = image->patternSize;
+    bool powerOfTwo = patternSize > 0 && (patternSize & (patternSize - 1)) == 0;
+    
+    image->patternShift = 0;
+    while(powerOfTwo && (1u << image->patternShift) < patternSize){
+        image->patternShift++;
+    }
+    
+    if(powerOfTwo){
+        image->getPixel = image->hasAlpha ? librif_cimage_get_pixel_shift_alpha : librif_cimage_get_pixel_shift_color;
+    }
+    else {
+        image->getPixel = image->hasAlpha ? librif_cimage_get_pixel_divide_alpha : librif_cimage_get_pixel_divide_color;
+    }
+}
+
+void librif_cimage_copy_rect(RIF_CImage *image, int x, int y, int width, int height, uint8_t *dst, size_t dstStride, RIF_PixelFormat format){
+    
+    int left, count, right;
+    bool visible = librif_clip_row(x, width, image->width, &left, &count, &right);
+    
+    int patternSize = image->patternSize;
+    
+    size_t pixelSize = image->hasAlpha ? 2 : 1;
+    size_t dstPixelSize = (format == RIF_PixelFormatColorAlpha) ? 2 : 1;
+    
+    int x0 = x + left;
+    int firstCellCol = visible ? x0 / patternSize : 0;
+    int firstPatternX = visible ? x0 - firstCellCol * patternSize : 0;
+    
+    for(int j = 0; j < height; j++){
+        int imageY = y + j;
+        
+        if(!visible || imageY < 0 || imageY >= image->height){
+            librif_fill_row(dst, format, width);
+            dst += dstStride;
+            continue;
+        }
+        
+        librif_fill_row(dst, format, left);
+        
+        int cellRow = imageY / patternSize;
+        int patternY = imageY - cellRow * patternSize;
+        
+        int cell_i = cellRow * image->cellCols + firstCellCol;
+        int patternX = firstPatternX;
+        
+        uint8_t *rowDst = &dst[left * dstPixelSize];
+        int remaining = count;
+        
+        // one pattern-row segment per cell
+        while(remaining > 0){
+            int segment = patternSize - patternX;
+            if(segment > remaining){
+                segment = remaining;
+            }
+            
+            const uint8_t *pattern = librif_cimage_get_pattern(image, cell_i);
+            librif_copy_row(&pattern[(patternY * patternSize + patternX) * pixelSize], image->hasAlpha, rowDst, format, segment);
+            
+            rowDst += segment * dstPixelSize;
+            remaining -= segment;
+            
+            cell_i++;
+            patternX = 0;
+        }
+        
+        librif_fill_row(rowDst, format, right);
+        
+        dst += dstStride;
+    }
+}
+
+RIF_CImageRow* librif_cimage_row_begin(RIF_CImage *image, int y, int x0, int x1, RIF_PixelFormat format){
+    
+    RIF_CImageRow *row = librif_malloc(sizeof(RIF_CImageRow));
+    if(row == NULL){
+        return NULL;
+    }
+    
+    if(!librif_cimage_row_init(row, image, y, x0, x1, format)){
+        librif_free(row);
+        return NULL;
+    }
+    
+    return row;
+}
+
+bool librif_cimage_row_init(RIF_CImageRow *row, RIF_CImage *image, int y, int x0, int x1, RIF_PixelFormat format){
+    
+    row->image = image;
+    row->format = format;
+    row->y = y;
+    
+    int width = (x1 > x0) ? (x1 - x0) : 0;
+    bool visible = librif_clip_row(x0, width, image->width, &row->left, &row->count, &row->right);
+    
+    int patternSize = image->patternSize;
+    int firstX = x0 + row->left;
+    
+    row->firstCellCol = visible ? firstX / patternSize : 0;
+    row->firstPatternX = visible ? firstX - row->firstCellCol * patternSize : 0;
+    
+    // one segment per cell crossed by the row
+    row->numberOfSegments = visible ? (row->firstPatternX + row->count + patternSize - 1) / patternSize : 0;
+    row->segments = row->segmentsBuffer;
+    
+    if(row->numberOfSegments > RIF_ROW_SEGMENTS){
+        row->segments = librif_malloc(row->numberOfSegments * sizeof(uint8_t*));
+        if(row->segments == NULL){
+            return false;
+        }
+    }
+    
+    row->cellRow = -1;
+    row->rowOffset = 0;
+    
+    return true;
+}
+
+bool librif_cimage_row_next(RIF_CImageRow *row, uint8_t *out){
+    
+    RIF_CImage *image = row->image;
+    
+    if(row->y >= image->height){
+        return false;
+    }
+    
+    int y = row->y++;
+    
+    if(y < 0 || row->count == 0){
+        librif_fill_row(out, row->format, row->left + row->count + row->right);
+        return true;
+    }
+    
+    int patternSize = image->patternSize;
+    size_t pixelSize = image->hasAlpha ? 2 : 1;
+    size_t dstPixelSize = (row->format == RIF_PixelFormatColorAlpha) ? 2 : 1;
+    
+    int cellRow = y / patternSize;
+    
+    if(cellRow != row->cellRow){
+        // look up the patterns once per cell row
+        int patternY = y - cellRow * patternSize;
+        int cell_i = cellRow * image->cellCols + row->firstCellCol;
+        
+        for(int i = 0; i < row->numberOfSegments; i++){
+            int patternX = (i == 0) ? row->firstPatternX : 0;
+            row->segments[i] = &librif_cimage_get_pattern(image, cell_i + i)[patternX * pixelSize];
+        }
+        
+        row->cellRow = cellRow;
+        row->rowOffset = patternY * patternSize * pixelSize;
+    }
+    
+    librif_fill_row(out, row->format, row->left);
+    
+    uint8_t *rowDst = &out[row->left * dstPixelSize];
+    int remaining = row->count;
+    int segment = patternSize - row->firstPatternX;
+    
+    for(int i = 0; i < row->numberOfSegments; i++){
+        if(segment > remaining){
+            segment = remaining;
+        }
+        
+        librif_copy_row(row->segments[i] + row->rowOffset, image->hasAlpha, rowDst, row->format, segment);
+        
+        rowDst += segment * dstPixelSize;
+        remaining -= segment;
+        segment = patternSize;
+    }
+    
+    librif_fill_row(rowDst, row->format, row->right);
+    
+    // next pattern row in the same cells
+    row->rowOffset += patternSize * pixelSize;
+    
+    return true;
+}
+
+void librif_cimage_row_free(RIF_CImageRow *row){
+    librif_cimage_row_release(row);
+    librif_free(row);
+}
+
+void librif_cimage_row_release(RIF_CImageRow *row){
+    if(row->segments != row->segmentsBuffer){
+        librif_free(row->segments);
+    }
+    row->segments = row->segmentsBuffer;
+}
+
+bool librif_cimage_dither(RIF_CImage *image, RIF_Rect rect, RIF_DitherMethod method, uint8_t *dst, size_t dstStride, uint8_t *mask, size_t maskStride){
+    
+    if(image->ditheredPatterns == NULL || image->ditherMethod != method){
+        return librif_dither_base(NULL, image, rect, method, dst, dstStride, mask, maskStride);
+    }
+    
+    if(rect.width <= 0 || rect.height <= 0){
+        return true;
+    }
+    
+    if(!librif_cimage_dither_cells(image, image->ditheredPatterns, false, rect, dst, dstStride)){
+        return false;
+    }
+    
+    return (mask == NULL || librif_cimage_dither_cells(image, image->ditheredMasks, true, rect, mask, maskStride));
+}
+
+bool librif_cimage_dither_patterns(RIF_CImage *image, RIF_DitherMethod method){
+    
+    int matrixSize = librif_dither_matrix_size(method);
+    unsigned int patternSize = image->patternSize;
+    
+    // each cell starts at a multiple of the matrix size, so patterns can be dithered once
+    if(method == RIF_DitherFloydSteinberg || method == RIF_DitherAtkinson){
+        return false;
+    }
+    if(patternSize == 0 || patternSize % matrixSize != 0 || image->patternsReadBytes < image->patternsTotalBytes){
+        return false;
+    }
+    
+    size_t rowSize = (patternSize + 7) / 8;
+    size_t blockSize = rowSize * patternSize;
+    size_t blocksSize = blockSize * image->numberOfPatterns;
+    
+    size_t pixelSize = image->hasAlpha ? 2 : 1;
+    size_t patternSizeInBytes = get_pixels_size_in_bytes(patternSize, patternSize, image->hasAlpha);
+    
+    // previous patterns are kept if the new ones can't be allocated
+    uint8_t *ditheredPatterns = librif_malloc(blocksSize > 0 ? blocksSize : 1);
+    uint8_t *ditheredMasks = image->hasAlpha ? librif_malloc(blocksSize > 0 ? blocksSize : 1) : NULL;
+    
+    // colors, alphas, a row of 128 for the mask, one threshold row per matrix row
+    uint8_t *colors = librif_malloc(patternSize * (3 + matrixSize));
+    
+    if(ditheredPatterns == NULL || (image->hasAlpha && ditheredMasks == NULL) || colors == NULL){
+        librif_free(ditheredPatterns);
+        librif_free(ditheredMasks);
+        librif_free(colors);
+        return false;
+    }
+    
+    if(image->ditheredPatterns != NULL){
+        librif_free(image->ditheredPatterns);
+    }
+    if(image->ditheredMasks != NULL){
+        librif_free(image->ditheredMasks);
+    }
+    
+    image->ditheredPatterns = ditheredPatterns;
+    image->ditheredMasks = ditheredMasks;
+    image->ditherMethod = method;
+    
+    uint8_t *alphas = &colors[patternSize];
+    uint8_t *halves = &alphas[patternSize];
+    uint8_t *thresholds = &halves[patternSize];
+    
+    memset(halves, 128, patternSize);
+    
+    for(int j = 0; j < matrixSize; j++){
+        for(unsigned int i = 0; i < patternSize; i++){
+            thresholds[j * patternSize + i] = librif_bayer_threshold(i % matrixSize, j, matrixSize);
+        }
+    }
+    
+    for(unsigned int pattern_i = 0; pattern_i < image->numberOfPatterns; pattern_i++){
+        const uint8_t *pattern = &image->patterns[pattern_i * patternSizeInBytes];
+        
+        for(unsigned int j = 0; j < patternSize; j++){
+            const uint8_t *src = &pattern[j * patternSize * pixelSize];
+            size_t offset = pattern_i * blockSize + j * rowSize;
+            
+            if(image->hasAlpha){
+                librif_split_row(src, colors, alphas, patternSize);
+                librif_dither_pack_row(alphas, halves, &image->ditheredMasks[offset], patternSize);
+                src = colors;
+            }
+            
+            librif_dither_pack_row(src, &thresholds[(j % matrixSize) * patternSize], &image->ditheredPatterns[offset], patternSize);
+        }
+    }
+    
+    librif_free(colors);
+    
+    return true;
+}
+
+// MSB-first bit output for the cell blit
+typedef struct {
+    uint8_t *dst;
+    uint32_t bits;
+    int count;
+} RIF_BitWriter;
+
+// byte holds count bits from the MSB, the other bits are cleared
+static inline void librif_bits_append(RIF_BitWriter *writer, uint8_t byte, int count){
+    writer->bits |= (uint32_t)byte << (24 - writer->count);
+    writer->count += count;
+    if(writer->count >= 8){
+        *writer->dst++ = writer->bits >> 24;
+        writer->bits <<= 8;
+        writer->count -= 8;
+    }
+}
+
+static inline void librif_bits_fill(RIF_BitWriter *writer, bool value, int count){
+    while(count > 0){
+        int n = count < 8 ? count : 8;
+        librif_bits_append(writer, value ? (uint8_t)(0xFF00 >> n) : 0, n);
+        count -= n;
+    }
+}
+
+static inline void librif_bits_copy(RIF_BitWriter *writer, const uint8_t *src, int start, int count){
+    
+    src += start >> 3;
+    int offset = start & 7;
+    
+    if(offset == 0 && writer->count == 0 && count >= 8){
+        // both sides are byte aligned
+        int bytes = count >> 3;
+        memcpy(writer->dst, src, bytes);
+        writer->dst += bytes;
+        src += bytes;
+        count -= bytes * 8;
+    }
+    
+    // whole bytes keep the number of pending bits, the writer is kept in locals
+    uint8_t *dst = writer->dst;
+    uint32_t bits = writer->bits;
+    int shift = 24 - writer->count;
+    
+    for(; count >= 8; count -= 8){
+        uint8_t byte = offset ? (uint8_t)(src[0] << offset | src[1] >> (8 - offset)) : src[0];
+        bits |= (uint32_t)byte << shift;
+        *dst++ = bits >> 24;
+        bits <<= 8;
+        src++;
+    }
+    
+    writer->dst = dst;
+    writer->bits = bits;
+    
+    if(count > 0){
+        uint8_t byte = src[0] << offset;
+        if(offset + count > 8){
+            byte |= src[1] >> (8 - offset);
+        }
+        librif_bits_append(writer, byte & (uint8_t)(0xFF00 >> count), count);
+    }
+}
+
+// assembles rows from 1-bit pattern blocks, fillValue is used outside the image or when blocks is NULL
+static bool librif_cimage_dither_cells(RIF_CImage *image, const uint8_t *blocks, bool fillValue, RIF_Rect rect, uint8_t *dst, size_t dstStride){
+    
+    int left, count, right;
+    bool visible = librif_clip_row(rect.x, rect.width, image->width, &left, &count, &right);
+    
+    int patternSize = image->patternSize;
+    size_t rowSize = (patternSize + 7) / 8;
+    size_t blockSize = rowSize * patternSize;
+    
+    int x0 = rect.x + left;
+    int firstCellCol = visible ? x0 / patternSize : 0;
+    int firstPatternX = visible ? x0 - firstCellCol * patternSize : 0;
+    int cellCount = visible ? (firstPatternX + count + patternSize - 1) / patternSize : 0;
+    
+    // blocks of the visible cells in the current cell row, and their pattern rows side by side,
+    // a screen wide rect takes a few hundred bytes of the stack buffer
+    const uint8_t *stackBuffer[RIF_DITHER_BUFFER_SIZE / sizeof(uint8_t*)];
+    uint8_t *buffer = (uint8_t*)stackBuffer;
+    
+    size_t bufferSize = cellCount * (sizeof(uint8_t*) + rowSize);
+    if(bufferSize > RIF_DITHER_BUFFER_SIZE){
+        buffer = librif_malloc(bufferSize);
+        if(buffer == NULL){
+            return false;
+        }
+    }
+    
+    const uint8_t **cellBlocks = (const uint8_t**)buffer;
+    uint8_t *line = &buffer[cellCount * sizeof(uint8_t*)];
+    int lineCellRow = -1;
+    
+    for(int j = 0; j < rect.height; j++){
+        int imageY = rect.y + j;
+        
+        RIF_BitWriter writer = { dst, 0, 0 };
+        
+        if(blocks == NULL || !visible || imageY < 0 || imageY >= image->height){
+            librif_bits_fill(&writer, fillValue, rect.width);
+        }
+        else {
+            librif_bits_fill(&writer, fillValue, left);
+            
+            int cellRow = imageY / patternSize;
+            int patternY = imageY - cellRow * patternSize;
+            
+            // cell lookups are shared by the rows of a cell row
+            if(cellRow != lineCellRow){
+                int cell_i = cellRow * image->cellCols + firstCellCol;
+                for(int i = 0; i < cellCount; i++){
+                    cellBlocks[i] = &blocks[librif_cimage_get_pattern_index(image, cell_i + i) * blockSize];
+                }
+                lineCellRow = cellRow;
+            }
+            
+            size_t rowOffset = patternY * rowSize;
+            
+            if(rowSize == 1){
+                for(int i = 0; i < cellCount; i++){
+                    line[i] = cellBlocks[i][rowOffset];
+                }
+            }
+            else {
+                for(int i = 0; i < cellCount; i++){
+                    memcpy(&line[i * rowSize], &cellBlocks[i][rowOffset], rowSize);
+                }
+            }
+            
+            if(patternSize % 8 == 0){
+                // pattern rows are whole bytes, the line is one contiguous run of bits
+                librif_bits_copy(&writer, line, firstPatternX, count);
+            }
+            else {
+                int patternX = firstPatternX;
+                int remaining = count;
+                
+                for(int i = 0; remaining > 0; i++){
+                    int segment = patternSize - patternX;
+                    if(segment > remaining){
+                        segment = remaining;
+                    }
+                    
+                    librif_bits_copy(&writer, &line[i * rowSize], patternX, segment);
+                    
+                    remaining -= segment;
+                    patternX = 0;
+                }
+            }
+            
+            librif_bits_fill(&writer, fillValue, right);
+        }
+        
+        // trailing bits of the last byte are cleared
+        if(writer.count > 0){
+            *writer.dst = writer.bits >> 24;
+        }
+        
+        dst += dstStride;
+    }
+    
+    if(buffer != (uint8_t*)stackBuffer){
+        librif_free(buffer);
+    }
+    
+    return true;
+}
+
+void librif_cimage_sample_affine_row(RIF_CImage *image, int32_t u0, int32_t v0, int32_t du, int32_t dv, int count, RIF_WrapMode wrapMode, RIF_Filter filter, uint8_t *out, RIF_PixelFormat format){
+    librif_sample_affine_row_base(NULL, image, u0, v0, du, dv, count, wrapMode, filter, out, format);
+}
+
+static inline bool librif_wrap_coordinate(int *x, int size, RIF_WrapMode wrapMode){
+    if(*x >= 0 && *x < size){
+        return true;
+    }
+    switch(wrapMode){
+        case RIF_WrapClamp:
+            *x = (*x < 0) ? 0 : (size - 1);
+            return true;
+        case RIF_WrapRepeat:
+            *x %= size;
+            if(*x < 0){
+                *x += size;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+// power-of-two exponent, rounded up
+static inline int librif_log2(unsigned int value){
+    int n = 0;
+    while((1u << n) < value){
+        n++;
+    }
+    return n;
+}
+
+// fields used by every sample, copied once per row
+typedef struct {
+    const uint8_t *pixels;
+    const uint8_t *cells;
+    RIF_CImage *cimage;
+    int width;
+    int height;
+    int pixelSize;
+    int patternSize;
+    int patternShift;
+    int cellCols;
+    unsigned int cellIndexSize;
+    size_t patternBytes;
+    size_t rowBytes;
+} RIF_Sampler;
+
+static RIF_Sampler librif_sampler_make(RIF_Image *image, RIF_CImage *cimage){
+    
+    RIF_Sampler sampler;
+    RIF_Sampler *s = &sampler;
+    
+    memset(s, 0, sizeof(RIF_Sampler));
+    s->cimage = cimage;
+    
+    if(image != NULL){
+        s->pixels = image->pixels;
+        s->width = image->width;
+        s->height = image->height;
+        s->pixelSize = image->hasAlpha ? 2 : 1;
+        s->rowBytes = (size_t)image->width * s->pixelSize;
+        return sampler;
+    }
+    
+    // pixels are the patterns, cells is NULL when indexes are read from the mapped file
+    s->pixels = cimage->patterns;
+    #ifdef RIF_PLAYDATE
+    s->cells = cimage->cells;
+    #else
+    s->cells = (cimage->cellIndexes == NULL) ? cimage->cells : NULL;
+    #endif
+    
+    s->width = cimage->width;
+    s->height = cimage->height;
+    s->pixelSize = cimage->hasAlpha ? 2 : 1;
+    s->patternSize = cimage->patternSize;
+    s->patternShift = ((cimage->patternSize & (cimage->patternSize - 1)) == 0) ? librif_log2(cimage->patternSize) : -1;
+    s->cellCols = cimage->cellCols;
+    s->cellIndexSize = cimage->cellIndexSize;
+    s->patternBytes = get_pixels_size_in_bytes(cimage->patternSize, cimage->patternSize, cimage->hasAlpha);
+    s->rowBytes = (size_t)cimage->patternSize * s->pixelSize;
+    
+    return sampler;
+}
+
+// x, y must be inside the image, patternX and patternY receive the position inside the cell
+static const uint8_t* librif_sampler_cell_pixel(const RIF_Sampler *sampler, int x, int y, int *patternX, int *patternY){
+    
+    int cellCol, cellRow;
+    
+    if(sampler->patternShift >= 0){
+        cellCol = x >> sampler->patternShift;
+        cellRow = y >> sampler->patternShift;
+    }
+    else {
+        cellCol = x / sampler->patternSize;
+        cellRow = y / sampler->patternSize;
+    }
+    
+    *patternX = x - cellCol * sampler->patternSize;
+    *patternY = y - cellRow * sampler->patternSize;
+    int cell_i = cellRow * sampler->cellCols + cellCol;
+    
+    uint32_t index;
+    
+    if(sampler->cells == NULL){
+        index = librif_cimage_get_pattern_index(sampler->cimage, cell_i);
+    }
+    else if(sampler->cellIndexSize == 1){
+        index = sampler->cells[cell_i];
+    }
+    else if(sampler->cellIndexSize == 2){
+        index = ((const uint16_t*)sampler->cells)[cell_i];
+    }
+    else {
+        index = ((const uint32_t*)sampler->cells)[cell_i];
+    }
+    
+    return &sampler->pixels[index * sampler->patternBytes + (*patternY * sampler->patternSize + *patternX) * sampler->pixelSize];
+}
+
+static inline const uint8_t* librif_sampler_pixel(const RIF_Sampler *sampler, int x, int y){
+    
+    if(sampler->cimage == NULL){
+        return &sampler->pixels[((size_t)y * sampler->width + x) * sampler->pixelSize];
+    }
+    
+    int patternX, patternY;
+    return librif_sampler_cell_pixel(sampler, x, y, &patternX, &patternY);
+}
+
+// p00, p10, p01, p11 of a 2x2 quad at x, y, which must be inside the image with its neighbours
+static inline void librif_sampler_quad(const RIF_Sampler *sampler, int x, int y, const uint8_t *pixels[4]){
+    
+    if(sampler->cimage == NULL){
+        pixels[0] = &sampler->pixels[((size_t)y * sampler->width + x) * sampler->pixelSize];
+    }
+    else {
+        int patternX, patternY;
+        pixels[0] = librif_sampler_cell_pixel(sampler, x, y, &patternX, &patternY);
+        
+        // neighbours in other cells need their own lookup
+        if((patternX + 1) == sampler->patternSize || (patternY + 1) == sampler->patternSize){
+            for(int k = 1; k < 4; k++){
+                pixels[k] = librif_sampler_cell_pixel(sampler, x + (k & 1), y + (k >> 1), &patternX, &patternY);
+            }
+            return;
+        }
+    }
+    
+    pixels[1] = pixels[0] + sampler->pixelSize;
+    pixels[2] = pixels[0] + sampler->rowBytes;
+    pixels[3] = pixels[2] + sampler->pixelSize;
+}
+
+// quad crossing the edges, texels are wrapped one by one
+static void librif_sampler_edge_quad(const RIF_Sampler *sampler, int x, int y, RIF_WrapMode wrapMode, uint8_t colors[4], uint8_t alphas[4]){
+    
+    for(int k = 0; k < 4; k++){
+        int texelX = x + (k & 1);
+        int texelY = y + (k >> 1);
+        
+        // filled texels are black and opaque
+        colors[k] = 0;
+        alphas[k] = 255;
+        
+        if(librif_wrap_coordinate(&texelX, sampler->width, wrapMode) && librif_wrap_coordinate(&texelY, sampler->height, wrapMode)){
+            const uint8_t *pixel = librif_sampler_pixel(sampler, texelX, texelY);
+            colors[k] = pixel[0];
+            if(sampler->pixelSize == 2){
+                alphas[k] = pixel[1];
+            }
+        }
+    }
+}
+
+static inline uint8_t librif_bilinear(const uint8_t values[4], int fx, int fy){
+    int top = values[0] * (256 - fx) + values[1] * fx;
+    int bottom = values[2] * (256 - fx) + values[3] * fx;
+    return (top * (256 - fy) + bottom * fy + 32768) >> 16;
+}
+
+static void librif_sample_nearest_row(const RIF_Sampler *sampler, int32_t u, int32_t v, int32_t du, int32_t dv, int count, RIF_WrapMode wrapMode, uint8_t *out, RIF_PixelFormat format){
+    
+    bool hasAlpha = sampler->pixelSize == 2;
+    
+    for(int i = 0; i < count; i++){
+        int x = u >> 16;
+        int y = v >> 16;
+        
+        // filled samples are black and opaque
+        uint8_t color = 0;
+        uint8_t alpha = 255;
+        
+        if(librif_wrap_coordinate(&x, sampler->width, wrapMode) && librif_wrap_coordinate(&y, sampler->height, wrapMode)){
+            const uint8_t *pixel = librif_sampler_pixel(sampler, x, y);
+            color = pixel[0];
+            if(hasAlpha){
+                alpha = pixel[1];
+            }
+        }
+        
+        if(format == RIF_PixelFormatColorAlpha){
+            out[i * 2] = color;
+            out[i * 2 + 1] = alpha;
+        }
+        else {
+            out[i] = color;
+        }
+        
+        u = (int32_t)((uint32_t)u + (uint32_t)du);
+        v = (int32_t)((uint32_t)v + (uint32_t)dv);
+    }
+}
+
+static void librif_sample_bilinear_row(const RIF_Sampler *sampler, int32_t u, int32_t v, int32_t du, int32_t dv, int count, RIF_WrapMode wrapMode, uint8_t *out, RIF_PixelFormat format){
+    
+    bool hasAlpha = sampler->pixelSize == 2;
+    
+    for(int i = 0; i < count; i++){
+        // texel centers are at +0.5
+        int32_t us = (int32_t)((uint32_t)u - 0x8000);
+        int32_t vs = (int32_t)((uint32_t)v - 0x8000);
+        
+        int x = us >> 16;
+        int y = vs >> 16;
+        int fx = (us >> 8) & 0xFF;
+        int fy = (vs >> 8) & 0xFF;
+        
+        uint8_t colors[4];
+        uint8_t alphas[4] = { 255, 255, 255, 255 };
+        
+        if(x >= 0 && y >= 0 && x < (sampler->width - 1) && y < (sampler->height - 1)){
+            const uint8_t *pixels[4];
+            librif_sampler_quad(sampler, x, y, pixels);
+            
+            for(int k = 0; k < 4; k++){
+                colors[k] = pixels[k][0];
+                if(hasAlpha){
+                    alphas[k] = pixels[k][1];
+                }
+            }
+        }
+        else {
+            librif_sampler_edge_quad(sampler, x, y, wrapMode, colors, alphas);
+        }
+        
+        if(format == RIF_PixelFormatColorAlpha){
+            out[i * 2] = librif_bilinear(colors, fx, fy);
+            out[i * 2 + 1] = librif_bilinear(alphas, fx, fy);
+        }
+        else {
+            out[i] = librif_bilinear(colors, fx, fy);
+        }
+        
+        u = (int32_t)((uint32_t)u + (uint32_t)du);
+        v = (int32_t)((uint32_t)v + (uint32_t)dv);
+    }
+}
+
+// u, v are 16.16 fixed point
+static void librif_sample_affine_row_base(RIF_Image *image, RIF_CImage *cimage, int32_t u, int32_t v, int32_t du, int32_t dv, int count, RIF_WrapMode wrapMode, RIF_Filter filter, uint8_t *out, RIF_PixelFormat format){
+    
+    if(count <= 0){
+        return;
+    }
+    
+    RIF_Sampler sampler = librif_sampler_make(image, cimage);
+    
+    if(sampler.width <= 0 || sampler.height <= 0){
+        librif_fill_row(out, format, count);
+        return;
+    }
+    
+    if(filter == RIF_FilterBilinear){
+        librif_sample_bilinear_row(&sampler, u, v, du, dv, count, wrapMode, out, format);
+        return;
+    }
+    
+    int i = 0;
+    
+    if(librif_sample_gather != NULL){
+        i = librif_sample_gather(image, cimage, u, v, du, dv, count, wrapMode, out, format);
+        // unsigned math, coordinates wrap around like the per-sample additions
+        u = (int32_t)((uint32_t)u + (uint32_t)du * i);
+        v = (int32_t)((uint32_t)v + (uint32_t)dv * i);
+    }
+    
+    size_t outPixelSize = (format == RIF_PixelFormatColorAlpha) ? 2 : 1;
+    librif_sample_nearest_row(&sampler, u, v, du, dv, count - i, wrapMode, out + i * outPixelSize, format);
+}
+
+#ifdef RIF_SIMD_X86
+
+// size bytes (1, 2 or 4) at each offset. The 4-byte load ends at the last byte of the element, so nothing past it is read
+__attribute__((target("avx2")))
+static inline __m256i librif_gather_avx2(const uint8_t *base, __m256i offsets, int size){
+    
+    if(size == 4){
+        return _mm256_i32gather_epi32((const int*)base, offsets, 1);
+    }
+    
+    __m256i start = _mm256_max_epi32(_mm256_sub_epi32(offsets, _mm256_set1_epi32(4 - size)), _mm256_setzero_si256());
+    __m256i shift = _mm256_slli_epi32(_mm256_sub_epi32(offsets, start), 3);
+    __m256i value = _mm256_srlv_epi32(_mm256_i32gather_epi32((const int*)base, start, 1), shift);
+    
+    return _mm256_and_si256(value, _mm256_set1_epi32(size == 1 ? 0xFF : 0xFFFF));
+}
+
+__attribute__((target("avx2")))
+static int librif_sample_gather_avx2(RIF_Image *image, RIF_CImage *cimage, int32_t u, int32_t v, int32_t du, int32_t dv, int count, RIF_WrapMode wrapMode, uint8_t *out, RIF_PixelFormat format){
+    
+    int width = (image != NULL) ? image->width : cimage->width;
+    int height = (image != NULL) ? image->height : cimage->height;
+    bool hasAlpha = (image != NULL) ? image->hasAlpha : cimage->hasAlpha;
+    int pixelSize = hasAlpha ? 2 : 1;
+    
+    // repeat is a mask, so sizes must be powers of two
+    if(wrapMode == RIF_WrapRepeat && ((width & (width - 1)) != 0 || (height & (height - 1)) != 0)){
+        return 0;
+    }
+    
+    const uint8_t *pixels = NULL;
+    int patternShift = 0;
+    int cellIndexShift = 0;
+    
+    if(image != NULL){
+        if(image->pixels == NULL || get_pixels_size_in_bytes(width, height, hasAlpha) < 4){
+            return 0;
+        }
+        pixels = image->pixels;
+    }
+    else {
+        // native cells and power-of-two patterns, cells and patterns can't be shorter than a gather
+        unsigned int patternSize = cimage->patternSize;
+        if(cimage->cellIndexes != NULL || cimage->cells == NULL || (patternSize & (patternSize - 1)) != 0){
+            return 0;
+        }
+        if((size_t)cimage->numberOfCells * cimage->cellIndexSize < 4 || get_pixels_size_in_bytes(patternSize, patternSize, hasAlpha) < 4){
+            return 0;
+        }
+        patternShift = librif_log2(patternSize);
+        cellIndexShift = librif_log2(cimage->cellIndexSize);
+    }
+    
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i us = _mm256_add_epi32(_mm256_set1_epi32(u), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(du)));
+    __m256i vs = _mm256_add_epi32(_mm256_set1_epi32(v), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(dv)));
+    __m256i du8 = _mm256_set1_epi32((int32_t)((uint32_t)du * 8));
+    __m256i dv8 = _mm256_set1_epi32((int32_t)((uint32_t)dv * 8));
+    
+    __m256i zero = _mm256_setzero_si256();
+    __m256i maxX = _mm256_set1_epi32(width - 1);
+    __m256i maxY = _mm256_set1_epi32(height - 1);
+    __m256i widthV = _mm256_set1_epi32(width);
+    __m256i byteMask = _mm256_set1_epi32(0xFF);
+    
+    __m256i cellColsV = _mm256_set1_epi32(cimage != NULL ? cimage->cellCols : 0);
+    __m256i patternMask = _mm256_set1_epi32(cimage != NULL ? cimage->patternSize - 1 : 0);
+    __m256i patternBytes = _mm256_set1_epi32(cimage != NULL ? (int)get_pixels_size_in_bytes(cimage->patternSize, cimage->patternSize, hasAlpha) : 0);
+    
+    int i = 0;
+    
+    for(; i + 8 <= count; i += 8){
+        __m256i x = _mm256_srai_epi32(us, 16);
+        __m256i y = _mm256_srai_epi32(vs, 16);
+        __m256i outside = zero;
+        
+        if(wrapMode == RIF_WrapRepeat){
+            x = _mm256_and_si256(x, maxX);
+            y = _mm256_and_si256(y, maxY);
+        }
+        else {
+            if(wrapMode == RIF_WrapFill){
+                __m256i outsideX = _mm256_or_si256(_mm256_cmpgt_epi32(zero, x), _mm256_cmpgt_epi32(x, maxX));
+                __m256i outsideY = _mm256_or_si256(_mm256_cmpgt_epi32(zero, y), _mm256_cmpgt_epi32(y, maxY));
+                outside = _mm256_or_si256(outsideX, outsideY);
+            }
+            // filled samples are clamped too, so the gather stays inside the image
+            x = _mm256_min_epi32(_mm256_max_epi32(x, zero), maxX);
+            y = _mm256_min_epi32(_mm256_max_epi32(y, zero), maxY);
+        }
+        
+        __m256i value;
+        
+        if(image != NULL){
+            __m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(y, widthV), x);
+            if(hasAlpha){
+                offset = _mm256_slli_epi32(offset, 1);
+            }
+            value = librif_gather_avx2(pixels, offset, pixelSize);
+        }
+        else {
+            __m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(y, patternShift), cellColsV), _mm256_srli_epi32(x, patternShift));
+            __m256i index = librif_gather_avx2(cimage->cells, _mm256_slli_epi32(cell, cellIndexShift), cimage->cellIndexSize);
+            
+            __m256i pixel = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(y, patternMask), patternShift), _mm256_and_si256(x, patternMask));
+            if(hasAlpha){
+                pixel = _mm256_slli_epi32(pixel, 1);
+            }
+            value = librif_gather_avx2(cimage->patterns, _mm256_add_epi32(_mm256_mullo_epi32(index, patternBytes), pixel), pixelSize);
+        }
+        
+        __m256i color = _mm256_and_si256(value, byteMask);
+        __m256i alpha = hasAlpha ? _mm256_and_si256(_mm256_srli_epi32(value, 8), byteMask) : byteMask;
+        
+        // same as get_pixel outside the image, black and opaque
+        color = _mm256_andnot_si256(outside, color);
+        alpha = _mm256_or_si256(alpha, _mm256_and_si256(outside, byteMask));
+        
+        if(format == RIF_PixelFormatColorAlpha){
+            __m256i pair = _mm256_or_si256(color, _mm256_slli_epi32(alpha, 8));
+            __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(pair), _mm256_extracti128_si256(pair, 1));
+            _mm_storeu_si128((__m128i*)&out[i * 2], packed);
+        }
+        else {
+            __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(color), _mm256_extracti128_si256(color, 1));
+            _mm_storel_epi64((__m128i*)&out[i], _mm_packus_epi16(packed, packed));
+        }
+        
+        us = _mm256_add_epi32(us, du8);
+        vs = _mm256_add_epi32(vs, dv8);
+    }
+    
+    _mm256_zeroupper();
+    
+    return i;
+}
+
+#endif
+
+static bool librif_cimage_read_patterns(RIF_CImage *image, size_t size){
+        
+    size_t chunks = image->patternsTotalBytes;
+    if(size > 0){
+        chunks = size;
+    }
+    
+    if((image->patternsReadBytes + chunks) >= image->patternsTotalBytes){
+        chunks = image->patternsTotalBytes - image->patternsReadBytes;
+    }
+    
+    RIF_TRACE_BEGIN(RIF_TraceCImagePatterns);
+    
+    void *buffer = &image->patterns[image->patternsReadBytes];
+
+    size_t readSize = librif_io_read(&image->io, buffer, chunks);
+    
+    image->patternsReadBytes += readSize;
+    image->readBytes += readSize;
+    
+    RIF_TRACE_END(readSize);
+    
+    return (readSize == chunks);
+}
+
+static bool librif_cimage_read_cells(RIF_CImage *image, size_t size){
+
+    unsigned int cellIndexSize = image->cellIndexSize;
+    unsigned int fileCellIndexSize = image->fileCellIndexSize;
+    
+    // numberOfCells fits in an int, checked by librif_cimage_check_header
+    int chunks = (int)image->numberOfCells - image->cellsRead;
+    if(size > 0 && size / fileCellIndexSize < (size_t)chunks){
+        chunks = (size < fileCellIndexSize) ? 1 : (int)(size / fileCellIndexSize);
+    }
+    
+    RIF_TRACE_BEGIN(RIF_TraceCImageCells);
+    
+    int bufferCells = RIF_CELLS_BUFFER_SIZE / fileCellIndexSize;
+    
+    int endRead = image->cellsRead + chunks;
+    
+    // large chunks are decoded through the scratch buffer in slices
+    while(image->cellsRead < endRead){
+        
+        int count = endRead - image->cellsRead;
+        if(count > bufferCells){
+            count = bufferCells;
+        }
+        
+        size_t bufferSize = count * fileCellIndexSize;
+        uint8_t *cells = &image->cells[image->cellsRead * cellIndexSize];
+        
+        // 8-bit indexes need no decoding and are read in place
+        uint8_t *buffer = (fileCellIndexSize == 1) ? cells : image->cellsBuffer;
+        
+        if(librif_io_read(&image->io, buffer, bufferSize) != bufferSize){
+            RIF_TRACE_END((size_t)(image->cellsRead + chunks - endRead) * fileCellIndexSize);
+            return false;
+        }
+        
+        // narrowing drops high bytes, so the file indexes are checked before it
+        bool validCells = (cellIndexSize == fileCellIndexSize) || librif_check_cell_indexes(buffer, fileCellIndexSize, count, image->numberOfPatterns);
+        
+        if(cellIndexSize == fileCellIndexSize){
+            if(cellIndexSize == 2){
+                librif_decode_cells16(cells, buffer, count);
+            }
+            else if(cellIndexSize == 4){
+                librif_decode_cells32(cells, buffer, count);
+            }
+        }
+        else {
+            librif_narrow_cells(cells, cellIndexSize, buffer, fileCellIndexSize, count);
+        }
+        
+        // an index past the patterns fails the read, the cells are cleared so get_pixel stays in bounds
+        if(!validCells || !librif_check_cells(cells, cellIndexSize, count, image->numberOfPatterns)){
+            memset(cells, 0, (size_t)count * cellIndexSize);
+            RIF_TRACE_END((size_t)(image->cellsRead + chunks - endRead) * fileCellIndexSize);
+            return false;
+        }
+        
+        image->cellsRead += count;
+        image->readBytes += bufferSize;
+    }
+    
+    RIF_TRACE_END((size_t)chunks * fileCellIndexSize);
+    
+    return true;
+}
+
+static void librif_narrow_cells(uint8_t *cells, unsigned int cellIndexSize, const uint8_t *indexes, unsigned int fileCellIndexSize, int count){
+    
+    // big-endian indexes keep their significant bytes at the end
+    const uint8_t *bytes = &indexes[fileCellIndexSize - cellIndexSize];
+    
+    if(cellIndexSize == 1){
+        for(int i = 0; i < count; i++){
+            cells[i] = *bytes;
+            bytes += fileCellIndexSize;
+        }
+    }
+    else {
+        uint16_t *output = (uint16_t*)cells;
+        for(int i = 0; i < count; i++){
+            output[i] = bytes[0] << 8 | bytes[1];
+            bytes += fileCellIndexSize;
+        }
+    }
+}
+
+// the file isn't trusted: true if the pixels lie within the cells and patterns plus cells fit
+// in availableBytes, SIZE_MAX when the source size is unknown, so sizes computed from the header can't overflow
+static bool librif_cimage_check_header(uint32_t width, uint32_t height, uint32_t cx, uint32_t cy, uint32_t patternSize, uint32_t numberOfPatterns, bool hasAlpha, unsigned int fileCellIndexSize, size_t availableBytes){
+    
+    if(fileCellIndexSize == 0 || patternSize == 0 || patternSize > 0x8000 || width > INT32_MAX || height > INT32_MAX){
+        return false;
+    }
+    
+    if((uint64_t)cx * patternSize < width || (uint64_t)cy * patternSize < height){
+        return false;
+    }
+    
+    // the decompressed image must be addressable too
+    if(height != 0 && width > SIZE_MAX / 2 / height){
+        return false;
+    }
+    
+    size_t pixelsSizeInBytes = get_pixels_size_in_bytes(patternSize, patternSize, hasAlpha);
+    
+    if(numberOfPatterns > availableBytes / pixelsSizeInBytes){
+        return false;
+    }
+    availableBytes -= numberOfPatterns * pixelsSizeInBytes;
+    
+    if(cy != 0 && cx > availableBytes / fileCellIndexSize / cy){
+        return false;
+    }
+    
+    size_t numberOfCells = (size_t)cx * cy;
+    
+    // cells are counted in int, and every cell needs a pattern
+    return numberOfCells <= INT32_MAX && (numberOfCells == 0 || numberOfPatterns > 0);
+}
+// true if every big-endian index is below numberOfPatterns
+static bool librif_check_cell_indexes(const uint8_t *indexes, unsigned int cellIndexSize, size_t numberOfCells, unsigned int numberOfPatterns){
+    
+    if(numberOfCells == 0){
+        return true;
+    }
+    
+    // index sizes that can't reach numberOfPatterns need no scan
+    if(cellIndexSize < 4 && numberOfPatterns >> (cellIndexSize * 8) != 0){
+        return true;
+    }
+    
+    uint32_t maxIndex = 0;
+    
+    switch(cellIndexSize){
+        case 1:
+            for(size_t i = 0; i < numberOfCells; i++){
+                uint32_t index = indexes[i];
+                maxIndex = (index > maxIndex) ? index : maxIndex;
+            }
+            break;
+        case 2:
+            for(size_t i = 0; i < numberOfCells; i++){
+                uint32_t index = indexes[i * 2] << 8 | indexes[i * 2 + 1];
+                maxIndex = (index > maxIndex) ? index : maxIndex;
+            }
+            break;
+        default:
+            for(size_t i = 0; i < numberOfCells; i++){
+                uint32_t index = librif_uint32_from_bytes(&indexes[i * 4]);
+                maxIndex = (index > maxIndex) ? index : maxIndex;
+            }
+            break;
+    }
+    
+    return maxIndex < numberOfPatterns;
+}
+
+// true if every decoded index is below numberOfPatterns, maxima are kept per lane
+// of a 16-cell block so the loops vectorize at -O2
+static bool librif_check_cells(const uint8_t *cells, unsigned int cellIndexSize, int count, unsigned int numberOfPatterns){
+    
+    if(cellIndexSize < 4 && numberOfPatterns >> (cellIndexSize * 8) != 0){
+        return true;
+    }
+    
+    uint32_t maxIndex = 0;
+    int i = 0;
+    
+    if(cellIndexSize == 1){
+        uint8_t lanes[16] = { 0 };
+        for(; i + 16 <= count; i += 16){
+            for(int j = 0; j < 16; j++){
+                lanes[j] = (cells[i + j] > lanes[j]) ? cells[i + j] : lanes[j];
+            }
+        }
+        for(int j = 0; j < 16; j++){
+            maxIndex = (lanes[j] > maxIndex) ? lanes[j] : maxIndex;
+        }
+    }
+    else if(cellIndexSize == 2){
+        const uint16_t *cells16 = (const uint16_t*)cells;
+        uint16_t lanes[16] = { 0 };
+        for(; i + 16 <= count; i += 16){
+            for(int j = 0; j < 16; j++){
+                lanes[j] = (cells16[i + j] > lanes[j]) ? cells16[i + j] : lanes[j];
+            }
+        }
+        for(int j = 0; j < 16; j++){
+            maxIndex = (lanes[j] > maxIndex) ? lanes[j] : maxIndex;
+        }
+    }
+    else {
+        const uint32_t *cells32 = (const uint32_t*)cells;
+        uint32_t lanes[16] = { 0 };
+        for(; i + 16 <= count; i += 16){
+            for(int j = 0; j < 16; j++){
+                lanes[j] = (cells32[i + j] > lanes[j]) ? cells32[i + j] : lanes[j];
+            }
+        }
+        for(int j = 0; j < 16; j++){
+            maxIndex = (lanes[j] > maxIndex) ? lanes[j] : maxIndex;
+        }
+    }
+    
+    // tail
+    for(; i < count; i++){
+        uint32_t index = (cellIndexSize == 1) ? cells[i] : (cellIndexSize == 2) ? ((const uint16_t*)cells)[i] : ((const uint32_t*)cells)[i];
+        maxIndex = (index > maxIndex) ? index : maxIndex;
+    }
+    
+    return maxIndex < numberOfPatterns;
+}
+
+static unsigned int librif_cell_index_size_from_flags(uint8_t flags){
+    // bits 1-2 of the flags byte, 0 is the original 32-bit format
+    switch((flags >> 1) & 0x03){
+        case 0:
+            return 4;
+        case 1:
+            return 1;
+        case 2:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+static uint8_t librif_cell_index_flags(unsigned int cellIndexSize){
+    switch(cellIndexSize){
+        case 1:
+            return 1 << 1;
+        case 2:
+            return 2 << 1;
+        default:
+            return 0;
+    }
+}
+
+static unsigned int librif_cell_index_size(unsigned int numberOfPatterns){
+    if(numberOfPatterns <= 0x100){
+        return 1;
+    }
+    else if(numberOfPatterns <= 0x10000){
+        return 2;
+    }
+    return 4;
+}
+
+static void librif_decode_cells16_scalar(uint8_t *cells, const uint8_t *indexes, int count){
+    uint16_t *output = (uint16_t*)cells;
+    for(int i = 0; i < count; i++){
+        output[i] = indexes[0] << 8 | indexes[1];
+        indexes += 2;
+    }
+}
+
+static void librif_decode_cells32_scalar(uint8_t *cells, const uint8_t *indexes, int count){
+    uint32_t *output = (uint32_t*)cells;
+    for(int i = 0; i < count; i++){
+        output[i] = librif_uint32_from_bytes(indexes);
+        indexes += 4;
+    }
+}
+
+#ifdef RIF_SIMD_X86
+static void librif_decode_cells16_sse2(uint8_t *cells, const uint8_t *indexes, int count){
+    
+    int i = 0;
+    for(; i + 8 <= count; i += 8){
+        __m128i v = _mm_loadu_si128((const __m128i*)&indexes[i * 2]);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i*)&cells[i * 2], v);
+    }
+    
+    librif_decode_cells16_scalar(&cells[i * 2], &indexes[i * 2], count - i);
+}
+
+static void librif_decode_cells32_sse2(uint8_t *cells, const uint8_t *indexes, int count){
+    
+    int i = 0;
+    for(; i + 4 <= count; i += 4){
+        __m128i v = _mm_loadu_si128((const __m128i*)&indexes[i * 4]);
+        
+        // swap bytes then 16-bit halves
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        
+        _mm_storeu_si128((__m128i*)&cells[i * 4], v);
+    }
+    
+    librif_decode_cells32_scalar(&cells[i * 4], &indexes[i * 4], count - i);
+}
+
+__attribute__((target("avx2")))
+static void librif_decode_cells16_avx2(uint8_t *cells, const uint8_t *indexes, int count){
+    
+    __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    
+    int i = 0;
+    for(; i + 16 <= count; i += 16){
+        __m256i v = _mm256_loadu_si256((const __m256i*)&indexes[i * 2]);
+        _mm256_storeu_si256((__m256i*)&cells[i * 2], _mm256_shuffle_epi8(v, swap));
+    }
+    
+    // avoid the AVX to SSE transition penalty in the tail
+    _mm256_zeroupper();
+    
+    librif_decode_cells16_sse2(&cells[i * 2], &indexes[i * 2], count - i);
+}
+
+__attribute__((target("avx2")))
+static void librif_decode_cells32_avx2(uint8_t *cells, const uint8_t *indexes, int count){
+    
+    __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    
+    int i = 0;
+    for(; i + 8 <= count; i += 8){
+        __m256i v = _mm256_loadu_si256((const __m256i*)&indexes[i * 4]);
+        _mm256_storeu_si256((__m256i*)&cells[i * 4], _mm256_shuffle_epi8(v, swap));
+    }
+    
+    // avoid the AVX to SSE transition penalty in the tail
+    _mm256_zeroupper();
+    
+    librif_decode_cells32_sse2(&cells[i * 4], &indexes[i * 4], count - i);
+}
+#endif
+
+#ifdef RIF_SIMD_NEON
+static void librif_decode_cells16_neon(uint8_t *cells, const uint8_t *indexes, int count){
+    
+    int i = 0;
+    for(; i + 8 <= count; i += 8){
+        vst1q_u8(&cells[i * 2], vrev16q_u8(vld1q_u8(&indexes[i * 2])));
+    }
+    
+    librif_decode_cells16_scalar(&cells[i * 2], &indexes[i * 2], count - i);
+}
+
+static void librif_decode_cells32_neon(uint8_t *cells, const uint8_t *indexes, int count){
+    
+    int i = 0;
+    for(; i + 4 <= count; i += 4){
+        vst1q_u8(&cells[i * 4], vrev32q_u8(vld1q_u8(&indexes[i * 4])));
+    }
+    
+    librif_decode_cells32_scalar(&cells[i * 4], &indexes[i * 4], count - i);
+}
+#endif
+
+#ifdef RIF_TEST
+
+// every count up to two AVX2 blocks plus a tail, at unaligned offsets
+#define RIF_CHECK_DECODE_CELLS 40
+
+static bool librif_check_decode_function(RIF_DecodeCellsFunction function, RIF_DecodeCellsFunction scalar, unsigned int cellIndexSize){
+    
+    uint8_t indexes[RIF_CHECK_DECODE_CELLS * 4 + 3];
+    uint32_t expected[RIF_CHECK_DECODE_CELLS + 1];
+    uint32_t cells[RIF_CHECK_DECODE_CELLS + 1];
+    
+    for(size_t i = 0; i < sizeof(indexes); i++){
+        indexes[i] = (uint8_t)(i * 151 + 7);
+    }
+    
+    for(int offset = 0; offset < 4; offset++){
+        for(int count = 0; count <= RIF_CHECK_DECODE_CELLS; count++){
+            size_t size = (size_t)count * cellIndexSize;
+            
+            // the cell after count must be left untouched
+            memset(expected, 0xAA, sizeof(expected));
+            memset(cells, 0xAA, sizeof(cells));
+            
+            scalar((uint8_t*)expected, &indexes[offset], count);
+            function((uint8_t*)cells, &indexes[offset], count);
+            
+            if(memcmp(expected, cells, size + cellIndexSize) != 0){
+                return false;
+            }
+        }
+    }
+    
+    return true;
+}
+
+bool librif_check_decode(void){
+    
+    bool success = true;
+    
+    success &= librif_check_decode_function(librif_decode_cells16, librif_decode_cells16_scalar, 2);
+    success &= librif_check_decode_function(librif_decode_cells32, librif_decode_cells32_scalar, 4);
+    
+    // kernels not picked by librif_init are still used for tails
+    #if defined(RIF_SIMD_X86)
+    success &= librif_check_decode_function(librif_decode_cells16_sse2, librif_decode_cells16_scalar, 2);
+    success &= librif_check_decode_function(librif_decode_cells32_sse2, librif_decode_cells32_scalar, 4);
+    if(__builtin_cpu_supports("avx2")){
+        success &= librif_check_decode_function(librif_decode_cells16_avx2, librif_decode_cells16_scalar, 2);
+        success &= librif_check_decode_function(librif_decode_cells32_avx2, librif_decode_cells32_scalar, 4);
+    }
+    #elif defined(RIF_SIMD_NEON)
+    success &= librif_check_decode_function(librif_decode_cells16_neon, librif_decode_cells16_scalar, 2);
+    success &= librif_check_decode_function(librif_decode_cells32_neon, librif_decode_cells32_scalar, 4);
+    #endif
+    
+    return success;
+}
+
+#endif
+
+RIF_Image* librif_cimage_decompress(RIF_CImage *cimage, RIF_Pool *pool){
+    
+    RIF_TRACE_BEGIN(RIF_TraceDecompress);
+    
+    RIF_Image *image = librif_cimage_decompress_base(cimage, pool);
+    if(image != NULL){
+        librif_cimage_decompress_rows(cimage, image, 0, cimage->cellRows);
+    }
+    
+    RIF_TRACE_END(image ? get_pixels_size_in_bytes(image->width, image->height, image->hasAlpha) : 0);
+    return image;
+}
+
+RIF_Image* librif_cimage_open_decompressed(const char *filename, RIF_Pool *pool){
+    
+    RIF_TRACE_BEGIN(RIF_TraceDecompress);
+    
+    RIF_Image *image = NULL;
+    
+    RIF_IO io;
+    if(librif_io_file(&io, filename)){
+        image = librif_cimage_open_decompressed_io_base(io, pool);
+    }
+    
+    RIF_TRACE_END(image ? image->totalBytes : 0);
+    return image;
+}
+
+RIF_Image* librif_cimage_open_decompressed_io(RIF_IO io, RIF_Pool *pool){
+    
+    RIF_TRACE_BEGIN(RIF_TraceDecompress);
+    RIF_Image *image = librif_cimage_open_decompressed_io_base(io, pool);
+    RIF_TRACE_END(image ? image->totalBytes : 0);
+    
+    return image;
+}
+
+RIF_Image* librif_cimage_decompress_begin(RIF_CImage *cimage, RIF_Pool *pool){
+    
+    RIF_Image *image = librif_cimage_decompress_base(cimage, pool);
+    if(image != NULL){
+        // decompressed bytes, as for a read
+        image->totalBytes = get_pixels_size_in_bytes(image->width, image->height, image->hasAlpha);
+    }
+    
+    return image;
+}
+
+bool librif_cimage_decompress_budget(RIF_CImage *cimage, RIF_Image *image, uint32_t microseconds, bool *done){
+    
+    if(done != NULL){
+        *done = false;
+    }
+    
+    if(cimage->cellsRead < (int)cimage->numberOfCells){
+        // cells must be read first
+        return false;
+    }
+    
+    RIF_TRACE_BEGIN(RIF_TraceDecompress);
+    
+    size_t rowSize = (size_t)image->width * (image->hasAlpha ? 2 : 1);
+    size_t cellRowSize = rowSize * cimage->patternSize;
+    
+    size_t startBytes = image->readBytes;
+    uint64_t start = librif_time();
+    
+    while(image->readBytes < image->totalBytes){
+        
+        uint64_t elapsed = librif_time() - start;
+        if(image->readBytes > startBytes && elapsed >= microseconds){
+            break;
+        }
+        
+        size_t size = librif_budget_size(image->budgetRate, microseconds - (elapsed < microseconds ? elapsed : microseconds));
+        if(image->readBytes > startBytes && size < cellRowSize){
+            // the next row doesn't fit
+            break;
+        }
+        
+        unsigned int startRow = (unsigned int)(image->readBytes / cellRowSize);
+        unsigned int rows = (size > cellRowSize) ? (unsigned int)(size / cellRowSize) : 1;
+        unsigned int endRow = (rows < cimage->cellRows - startRow) ? (startRow + rows) : cimage->cellRows;
+        
+        uint64_t rowsStart = librif_time();
+        librif_cimage_decompress_rows(cimage, image, startRow, endRow);
+        
+        size_t readBytes = (size_t)endRow * cellRowSize;
+        if(readBytes > image->totalBytes){
+            readBytes = image->totalBytes;
+        }
+        
+        librif_budget_update(&image->budgetRate, readBytes - image->readBytes, librif_time() - rowsStart);
+        image->readBytes = readBytes;
+    }
+    
+    RIF_TRACE_END(image->readBytes - startBytes);
+    
+    if(done != NULL){
+        *done = (image->readBytes >= image->totalBytes);
+    }
+    
+    return true;
+}
+
+#ifndef RIF_PLAYDATE
+// task state lives on the stack, so a decompression makes no allocations
+#define RIF_DECOMPRESS_MAX_THREADS 64
+
+typedef struct {
+    RIF_CImage *cimage;
+    RIF_Image *image;
+    unsigned int startRow;
+    unsigned int endRow;
+} RIF_DecompressTask;
+
+static void* librif_cimage_decompress_task(void *arg){
+    RIF_DecompressTask *task = arg;
+    librif_cimage_decompress_rows(task->cimage, task->image, task->startRow, task->endRow);
+    return NULL;
+}
+
+RIF_Image* librif_cimage_decompress_parallel(RIF_CImage *cimage, RIF_Pool *pool, int nthreads){
+    
+    RIF_TRACE_BEGIN(RIF_TraceDecompress);
+    
+    RIF_Image *image = librif_cimage_decompress_base(cimage, pool);
+    if(image == NULL){
+        RIF_TRACE_END(0);
+        return NULL;
+    }
+    
+    if(nthreads <= 0){
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if(nthreads > (int)cimage->cellRows){
+        nthreads = cimage->cellRows;
+    }
+    if(nthreads > RIF_DECOMPRESS_MAX_THREADS){
+        nthreads = RIF_DECOMPRESS_MAX_THREADS;
+    }
+    
+    if(nthreads <= 1){
+        librif_cimage_decompress_rows(cimage, image, 0, cimage->cellRows);
+        RIF_TRACE_END(get_pixels_size_in_bytes(image->width, image->height, image->hasAlpha));
+        return image;
+    }
+    
+    // every task writes a disjoint band of cell rows, the calling thread takes the first one
+    RIF_DecompressTask tasks[RIF_DECOMPRESS_MAX_THREADS];
+    pthread_t threads[RIF_DECOMPRESS_MAX_THREADS];
+    bool started[RIF_DECOMPRESS_MAX_THREADS];
+    
+    for(int i = 0; i < nthreads; i++){
+        tasks[i].cimage = cimage;
+        tasks[i].image = image;
+        tasks[i].startRow = (unsigned int)((uint64_t)cimage->cellRows * i / nthreads);
+        tasks[i].endRow = (unsigned int)((uint64_t)cimage->cellRows * (i + 1) / nthreads);
+        
+        started[i] = false;
+        if(i > 0){
+            started[i] = (pthread_create(&threads[i], NULL, librif_cimage_decompress_task, &tasks[i]) == 0);
+        }
+    }
+    
+    librif_cimage_decompress_task(&tasks[0]);
+    
+    for(int i = 1; i < nthreads; i++){
+        if(started[i]){
+            pthread_join(threads[i], NULL);
+        }
+        else {
+            // thread creation failed, run the band here
+            librif_cimage_decompress_task(&tasks[i]);
+        }
+    }
+    
+    RIF_TRACE_END(get_pixels_size_in_bytes(image->width, image->height, image->hasAlpha));
+    return image;
+}
+
+//
+// Async loading
+//
+
+struct RIF_AsyncLoad {
+    char *filename;
+    RIF_Pool *pool;
+    bool compressed;
+    
+    RIF_AsyncCallback callback;
+    void *userdata;
+    
+    pthread_t thread;
+    bool joined;
+    
+    RIF_Image *image;
+    RIF_CImage *cimage;
+    
+    // shared with the worker, accessed with atomic loads and stores
+    int state;
+    int cancelled;
+    size_t readBytes;
+    size_t totalBytes;
+};
+
+// bytes read per step, progress and cancellation are checked between steps
+static const size_t asyncChunkSize = 64 * 1024;
+
+static void* librif_async_task(void *arg){
+    
+    RIF_AsyncLoad *load = arg;
+    RIF_AsyncState state = RIF_AsyncFailed;
+    
+    if(load->compressed){
+        RIF_CImage *cimage = librif_cimage_open(load->filename, load->pool);
+        if(cimage != NULL){
+            __atomic_store_n(&load->totalBytes, cimage->totalBytes, __ATOMIC_RELAXED);
+            
+            bool closed = false;
+            while(!closed && !__atomic_load_n(&load->cancelled, __ATOMIC_RELAXED)){
+                if(!librif_cimage_read(cimage, asyncChunkSize, &closed)){
+                    break;
+                }
+                __atomic_store_n(&load->readBytes, cimage->readBytes, __ATOMIC_RELAXED);
+            }
+            
+            load->cimage = cimage;
+            if(closed){
+                state = RIF_AsyncDone;
+            }
+        }
+    }
+    else {
+        RIF_Image *image = librif_image_open(load->filename, load->pool);
+        if(image != NULL){
+            __atomic_store_n(&load->totalBytes, image->totalBytes, __ATOMIC_RELAXED);
+            
+            bool closed = false;
+            while(!closed && !__atomic_load_n(&load->cancelled, __ATOMIC_RELAXED)){
+                if(!librif_image_read(image, asyncChunkSize, &closed)){
+                    break;
+                }
+                __atomic_store_n(&load->readBytes, image->readBytes, __ATOMIC_RELAXED);
+            }
+            
+            load->image = image;
+            if(closed){
+                state = RIF_AsyncDone;
+            }
+        }
+    }
+    
+    // publishes the image to threads that observe the new state
+    __atomic_store_n(&load->state, state, __ATOMIC_RELEASE);
+    
+    if(load->callback != NULL){
+        load->callback(load, load->userdata);
+    }
+    
+    return NULL;
+}
+
+static RIF_AsyncLoad* librif_async_open(const char *filename, RIF_Pool *pool, bool compressed, RIF_AsyncCallback callback, void *userdata){
+    
+    RIF_AsyncLoad *load = librif_malloc(sizeof(RIF_AsyncLoad));
+    if(load == NULL){
+        return NULL;
+    }
+    
+    size_t filenameSize = strlen(filename) + 1;
+    load->filename = librif_malloc(filenameSize);
+    if(load->filename == NULL){
+        librif_free(load);
+        return NULL;
+    }
+    memcpy(load->filename, filename, filenameSize);
+    
+    load->pool = pool;
+    load->compressed = compressed;
+    load->callback = callback;
+    load->userdata = userdata;
+    
+    load->joined = false;
+    
+    load->image = NULL;
+    load->cimage = NULL;
+    
+    load->state = RIF_AsyncLoading;
+    load->cancelled = 0;
+    load->readBytes = 0;
+    load->totalBytes = 0;
+    
+    if(pthread_create(&load->thread, NULL, librif_async_task, load) != 0){
+        librif_free(load->filename);
+        librif_free(load);
+        return NULL;
+    }
+    
+    return load;
+}
+
+RIF_AsyncLoad* librif_image_open_async(const char *filename, RIF_Pool *pool, RIF_AsyncCallback callback, void *userdata){
+    return librif_async_open(filename, pool, false, callback, userdata);
+}
+
+RIF_AsyncLoad* librif_cimage_open_async(const char *filename, RIF_Pool *pool, RIF_AsyncCallback callback, void *userdata){
+    return librif_async_open(filename, pool, true, callback, userdata);
+}
+
+RIF_AsyncState librif_async_get_state(RIF_AsyncLoad *load){
+    return __atomic_load_n(&load->state, __ATOMIC_ACQUIRE);
+}
+
+void librif_async_get_progress(RIF_AsyncLoad *load, size_t *readBytes, size_t *totalBytes){
+    if(readBytes != NULL){
+        *readBytes = __atomic_load_n(&load->readBytes, __ATOMIC_RELAXED);
+    }
+    if(totalBytes != NULL){
+        *totalBytes = __atomic_load_n(&load->totalBytes, __ATOMIC_RELAXED);
+    }
+}
+
+RIF_AsyncState librif_async_wait(RIF_AsyncLoad *load){
+    // from the callback the state is already final, the worker can't join itself
+    if(!load->joined && !pthread_equal(pthread_self(), load->thread)){
+        pthread_join(load->thread, NULL);
+        load->joined = true;
+    }
+    return librif_async_get_state(load);
+}
+
+RIF_Image* librif_async_take_image(RIF_AsyncLoad *load){
+    
+    if(librif_async_get_state(load) != RIF_AsyncDone){
+        return NULL;
+    }
+    
+    RIF_Image *image = load->image;
+    load->image = NULL;
+    
+    return image;
+}
+
+RIF_CImage* librif_async_take_cimage(RIF_AsyncLoad *load){
+    
+    if(librif_async_get_state(load) != RIF_AsyncDone){
+        return NULL;
+    }
+    
+    RIF_CImage *cimage = load->cimage;
+    load->cimage = NULL;
+    
+    return cimage;
+}
+
+void librif_async_free(RIF_AsyncLoad *load){
+    
+    __atomic_store_n(&load->cancelled, 1, __ATOMIC_RELAXED);
+    if(!load->joined && pthread_equal(pthread_self(), load->thread)){
+        // freed from the callback, the worker returns without touching the load
+        pthread_detach(load->thread);
+        load->joined = true;
+    }
+    librif_async_wait(load);
+    
+    // images that were not taken
+    if(load->image != NULL){
+        librif_image_free(load->image);
+    }
+    if(load->cimage != NULL){
+        librif_cimage_free(load->cimage);
+    }
+    
+    librif_free(load->filename);
+    librif_free(load);
+}
+#endif
+
+static RIF_Image* librif_cimage_decompress_base(RIF_CImage *cimage, RIF_Pool *pool){
+    
+    RIF_PoolMark mark = (pool != NULL) ? librif_pool_mark(pool) : 0;
+    
+    RIF_Image *image = librif_image_base(pool);
+    if(image == NULL){
+        return NULL;
+    }
+    
+    image->readBytes = 0;
+    image->totalBytes = 0;
+    
+    image->width = cimage->width;
+    image->height = cimage->height;
+    image->hasAlpha = cimage->hasAlpha;
+    librif_image_select_get_pixel(image);
+    
+    size_t pixelsSizeInBytes = get_pixels_size_in_bytes(image->width, image->height, image->hasAlpha);
+    
+    if(pool != NULL){
+        image->pixels = librif_pool_alloc(pool, pixelsSizeInBytes);
+        if(image->pixels == NULL){
+            librif_image_discard(image, mark);
+            return NULL;
+        }
+    }
+    else {
+        image->pixels = librif_malloc(pixelsSizeInBytes);
+    }
+    
+    return image;
+}
+
+// only the patterns are kept while decoding, allocated after the image so that a pool can be rewound
+static RIF_Image* librif_cimage_open_decompressed_io_base(RIF_IO io, RIF_Pool *pool){
+    
+    if(!librif_io_begin(&io, cheaderSizeInBytes)){
+        return NULL;
+    }
+    
+    uint8_t header[25];
+    if(librif_io_read(&io, header, cheaderSizeInBytes) != cheaderSizeInBytes){
+        if(io.close != NULL){
+            io.close(io.context);
+        }
+        return NULL;
+    }
+    
+    bool hasAlpha = (header[0] & alphaFlag) ? true : false;
+    unsigned int fileCellIndexSize = librif_cell_index_size_from_flags(header[0]);
+    
+    uint32_t width = librif_uint32_from_bytes(&header[1]);
+    uint32_t height = librif_uint32_from_bytes(&header[5]);
+    
+    uint32_t cx = librif_uint32_from_bytes(&header[9]);
+    uint32_t cy = librif_uint32_from_bytes(&header[13]);
+    
+    uint32_t patternSize = librif_uint32_from_bytes(&header[17]);
+    uint32_t numberOfPatterns = librif_uint32_from_bytes(&header[21]);
+    
+    bool validHeader = librif_cimage_check_header(width, height, cx, cy, patternSize, numberOfPatterns, hasAlpha, fileCellIndexSize, SIZE_MAX);
+    
+    unsigned int numberOfCells = validHeader ? cx * cy : 0;
+    size_t patternsSizeInBytes = validHeader ? numberOfPatterns * get_pixels_size_in_bytes(patternSize, patternSize, hasAlpha) : 0;
+    
+    if(!validHeader || !librif_io_has_bytes(&io, cheaderSizeInBytes + patternsSizeInBytes + (size_t)numberOfCells * fileCellIndexSize)){
+        if(io.close != NULL){
+            io.close(io.context);
+        }
+        return NULL;
+    }
+    
+    RIF_PoolMark mark = (pool != NULL) ? librif_pool_mark(pool) : 0;
+    
+    RIF_Image *image = librif_image_base(pool);
+    RIF_CImage *cimage = NULL;
+    
+    RIF_PoolMark patternsMark = 0;
+    
+    if(image != NULL){
+        image->width = width;
+        image->height = height;
+        image->hasAlpha = hasAlpha;
+        librif_image_select_get_pixel(image);
+        
+        image->totalBytes = get_pixels_size_in_bytes(image->width, image->height, hasAlpha);
+        image->pixels = (pool != NULL) ? librif_pool_alloc(pool, image->totalBytes) : librif_malloc(image->totalBytes);
+        
+        if(image->pixels != NULL){
+            patternsMark = (pool != NULL) ? librif_pool_mark(pool) : 0;
+            cimage = librif_cimage_base(pool);
+        }
+    }
+    
+    if(cimage != NULL){
+        cimage->io = io;
+        cimage->hasIO = true;
+        
+        cimage->hasAlpha = hasAlpha;
+        cimage->width = image->width;
+        cimage->height = image->height;
+        cimage->cellCols = cx;
+        cimage->cellRows = cy;
+        cimage->patternSize = patternSize;
+        cimage->numberOfCells = numberOfCells;
+        cimage->numberOfPatterns = numberOfPatterns;
+        cimage->fileCellIndexSize = fileCellIndexSize;
+        cimage->patternsTotalBytes = patternsSizeInBytes;
+        
+        cimage->patterns = (pool != NULL) ? librif_pool_alloc(pool, patternsSizeInBytes) : librif_malloc(patternsSizeInBytes);
+    }
+    
+    if(cimage == NULL || cimage->patterns == NULL){
+        if(cimage != NULL){
+            librif_cimage_discard(cimage, patternsMark);
+        }
+        else if(io.close != NULL){
+            io.close(io.context);
+        }
+        if(image != NULL){
+            librif_image_discard(image, mark);
+        }
+        return NULL;
+    }
+    
+    if(!librif_cimage_read_patterns(cimage, 0) || !librif_cimage_stream_cells(cimage, image)){
+        // the source ended early, the image goes with the patterns
+        librif_cimage_discard(cimage, patternsMark);
+        librif_image_discard(image, mark);
+        return NULL;
+    }
+    
+    image->readBytes = image->totalBytes;
+    
+    if(pool != NULL){
+        librif_io_close(&cimage->io, &cimage->hasIO);
+        librif_pool_rewind(pool, patternsMark);
+    }
+    else {
+        librif_cimage_free(cimage);
+    }
+    
+    return image;
+}
+
+// rows of 8 and 16 bytes are copied with a constant size, which compilers inline
+static inline void librif_copy_pattern_rows(uint8_t *dst, size_t dstStride, const uint8_t *src, size_t srcStride, size_t rowSize, int rows){
+    
+    if(rowSize == 8){
+        for(int j = 0; j < rows; j++){
+            memcpy(dst, src, 8);
+            src += srcStride;
+            dst += dstStride;
+        }
+    }
+    else if(rowSize == 16){
+        for(int j = 0; j < rows; j++){
+            memcpy(dst, src, 16);
+            src += srcStride;
+            dst += dstStride;
+        }
+    }
+    else {
+        for(int j = 0; j < rows; j++){
+            memcpy(dst, src, rowSize);
+            src += srcStride;
+            dst += dstStride;
+        }
+    }
+}
+
+// cells are written to the image as their indexes are read, the cell table is never built
+static bool librif_cimage_stream_cells(RIF_CImage *cimage, RIF_Image *image){
+    
+    RIF_TRACE_BEGIN(RIF_TraceCImageCells);
+    
+    size_t pixelSize = image->hasAlpha ? 2 : 1;
+    
+    int patternSize = cimage->patternSize;
+    
+    size_t patternRowSize = patternSize * pixelSize;
+    size_t patternSizeInBytes = patternRowSize * patternSize;
+    size_t imageRowSize = image->width * pixelSize;
+    
+    unsigned int fileCellIndexSize = cimage->fileCellIndexSize;
+    int bufferCells = RIF_CELLS_BUFFER_SIZE / fileCellIndexSize;
+    
+    // edges are clipped once per cell row, cells past them are read and skipped
+    unsigned int visibleCols = (image->width + patternSize - 1) / patternSize;
+    size_t lastRowSize = (image->width - (int)(visibleCols - 1) * patternSize) * pixelSize;
+    
+    unsigned int cellCol = 0;
+    int y = 0;
+    int rows = (image->height < patternSize) ? image->height : patternSize;
+    
+    uint8_t *cells = cimage->cellsBuffer;
+    
+    while(cimage->cellsRead < (int)cimage->numberOfCells){
+        
+        int count = (int)cimage->numberOfCells - cimage->cellsRead;
+        if(count > bufferCells){
+            count = bufferCells;
+        }
+        
+        if(librif_io_read(&cimage->io, cells, count * fileCellIndexSize) != count * fileCellIndexSize){
+            RIF_TRACE_END((size_t)cimage->cellsRead * fileCellIndexSize);
+            return false;
+        }
+        
+        // indexes are decoded in place and checked a slice at a time, as in read_cells
+        if(fileCellIndexSize == 2){
+            librif_decode_cells16(cells, cells, count);
+        }
+        else if(fileCellIndexSize == 4){
+            librif_decode_cells32(cells, cells, count);
+        }
+        
+        if(!librif_check_cells(cells, fileCellIndexSize, count, cimage->numberOfPatterns)){
+            RIF_TRACE_END((size_t)cimage->cellsRead * fileCellIndexSize);
+            return false;
+        }
+        
+        for(int i = 0; i < count; i++){
+            
+            if(cellCol < visibleCols && rows > 0){
+                uint32_t index = (fileCellIndexSize == 1) ? cells[i] : (fileCellIndexSize == 2) ? ((const uint16_t*)cells)[i] : ((const uint32_t*)cells)[i];
+                
+                const uint8_t *src = &cimage->patterns[index * patternSizeInBytes];
+                uint8_t *dst = &image->pixels[y * imageRowSize + cellCol * patternRowSize];
+                
+                size_t rowSize = (cellCol + 1 < visibleCols) ? patternRowSize : lastRowSize;
+                
+                librif_copy_pattern_rows(dst, imageRowSize, src, patternRowSize, rowSize, rows);
+            }
+            
+            if(++cellCol == cimage->cellCols){
+                cellCol = 0;
+                y += patternSize;
+                rows = (image->height - y < patternSize) ? image->height - y : patternSize;
+            }
+        }
+        
+        cimage->cellsRead += count;
+        cimage->readBytes += count * fileCellIndexSize;
+    }
+    
+    RIF_TRACE_END((size_t)cimage->numberOfCells * fileCellIndexSize);
+    
+    return true;
+}
+
+static void librif_cimage_decompress_rows(RIF_CImage *cimage, RIF_Image *image, unsigned int startRow, unsigned int endRow){
+    
+    size_t pixelSize = image->hasAlpha ? 2 : 1;
+    
+    int patternSize = cimage->patternSize;
+    
+    size_t patternRowSize = patternSize * pixelSize;
+    size_t imageRowSize = image->width * pixelSize;
+    
+    for(unsigned int cellRow = startRow; cellRow < endRow; cellRow++){
+        
+        int y = cellRow * patternSize;
+        int rows = (image->height - y) < patternSize ? (image->height - y) : patternSize;
+        
+        for(unsigned int cellCol = 0; cellCol < cimage->cellCols; cellCol++){
+            
+            int x = cellCol * patternSize;
+            int cols = (image->width - x) < patternSize ? (image->width - x) : patternSize;
+            
+            if(rows <= 0 || cols <= 0){
+                continue;
+            }
+            
+            // edges are clipped once per cell, pattern rows are copied as a whole
+            size_t rowSize = cols * pixelSize;
+            
+            const uint8_t *src = librif_cimage_get_pattern(cimage, cellRow * cimage->cellCols + cellCol);
+            uint8_t *dst = &image->pixels[y * imageRowSize + x * pixelSize];
+            
+            for(int j = 0; j < rows; j++){
+                memcpy(dst, src, rowSize);
+                src += patternRowSize;
+                dst += imageRowSize;
+            }
+        }
+    }
+}
+
+//
+// Encoder
+//
+
+typedef struct {
+    uint64_t *hashes;
+    uint32_t *indexes;
+    size_t mask;
+} RIF_PatternTable;
+
+static const uint32_t patternTableEmpty = UINT32_MAX;
+
+static uint64_t librif_hash_bytes(const uint8_t *bytes, size_t size){
+    
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ size;
+    
+    while(size >= 8){
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+        bytes += 8;
+        size -= 8;
+    }
+    
+    while(size > 0){
+        hash = (hash ^ *bytes) * 0xC4CEB9FE1A85EC53ull;
+        bytes++;
+        size--;
+    }
+    
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ull;
+    hash ^= hash >> 32;
+    
+    return hash;
+}
+
+static void librif_compress_get_pattern(RIF_Image *source, int x, int y, unsigned int patternSize, uint8_t *pattern){
+    
+    size_t pixelSize = source->hasAlpha ? 2 : 1;
+    
+    int cols = (source->width - x) < (int)patternSize ? (source->width - x) : (int)patternSize;
+    int rows = (source->height - y) < (int)patternSize ? (source->height - y) : (int)patternSize;
+    
+    size_t rowSize = cols * pixelSize;
+    size_t patternRowSize = patternSize * pixelSize;
+    
+    for(int j = 0; j < (int)patternSize; j++){
+        uint8_t *dst = &pattern[j * patternRowSize];
+        size_t copied = 0;
+        
+        if(j < rows){
+            memcpy(dst, &source->pixels[((y + j) * source->width + x) * pixelSize], rowSize);
+            copied = rowSize;
+        }
+        
+        // pixels outside the image are black and opaque, as in encoder.py
+        if(source->hasAlpha){
+            for(size_t i = copied; i < patternRowSize; i += 2){
+                dst[i] = 0;
+                dst[i + 1] = 255;
+            }
+        }
+        else {
+            memset(&dst[copied], 0, patternRowSize - copied);
+        }
+    }
+}
+
+// returns the encoded size in bytes, or SIZE_MAX when limit is exceeded
+static size_t librif_compress_with_size(RIF_Image *source, unsigned int patternSize, size_t limit, RIF_CImage *output){
+    
+    unsigned int cellCols = (source->width + patternSize - 1) / patternSize;
+    unsigned int cellRows = (source->height + patternSize - 1) / patternSize;
+    unsigned int numberOfCells = cellCols * cellRows;
+    
+    size_t patternSizeInBytes = get_pixels_size_in_bytes(patternSize, patternSize, source->hasAlpha);
+    
+    size_t tableSize = 16;
+    while(tableSize < (size_t)numberOfCells * 2){
+        tableSize *= 2;
+    }
+    
+    RIF_PatternTable table;
+    table.mask = tableSize - 1;
+    table.hashes = librif_malloc(tableSize * sizeof(uint64_t));
+    table.indexes = librif_malloc(tableSize * sizeof(uint32_t));
+    
+    for(size_t i = 0; i < tableSize; i++){
+        table.indexes[i] = patternTableEmpty;
+    }
+    
+    size_t patternsCapacity = 64;
+    uint8_t *patterns = librif_malloc(patternsCapacity * patternSizeInBytes);
+    unsigned int numberOfPatterns = 0;
+    
+    uint32_t *cellIndexes = NULL;
+    if(output != NULL){
+        cellIndexes = librif_malloc(numberOfCells * sizeof(uint32_t));
+    }
+    
+    uint8_t *pattern = librif_malloc(patternSizeInBytes);
+    
+    size_t patternsBytes = 0;
+    size_t bytes = 0;
+    
+    for(unsigned int cell_i = 0; cell_i < numberOfCells; cell_i++){
+        
+        int x = (cell_i % cellCols) * patternSize;
+        int y = (cell_i / cellCols) * patternSize;
+        
+        librif_compress_get_pattern(source, x, y, patternSize, pattern);
+        
+        uint64_t hash = librif_hash_bytes(pattern, patternSizeInBytes);
+        size_t slot = hash & table.mask;
+        
+        uint32_t patternIndex = patternTableEmpty;
+        
+        // open addressing with linear probing
+        while(table.indexes[slot] != patternTableEmpty){
+            if(table.hashes[slot] == hash && memcmp(&patterns[table.indexes[slot] * patternSizeInBytes], pattern, patternSizeInBytes) == 0){
+                patternIndex = table.indexes[slot];
+                break;
+            }
+            slot = (slot + 1) & table.mask;
+        }
+        
+        if(patternIndex == patternTableEmpty){
+            if(numberOfPatterns == patternsCapacity){
+                patternsCapacity *= 2;
+                patterns = librif_realloc(patterns, patternsCapacity * patternSizeInBytes);
+            }
+            
+            patternIndex = numberOfPatterns++;
+            memcpy(&patterns[patternIndex * patternSizeInBytes], pattern, patternSizeInBytes);
+            
+            table.hashes[slot] = hash;
+            table.indexes[slot] = patternIndex;
+            
+            patternsBytes += patternSizeInBytes;
+        }
+        
+        // the index size only grows with new patterns, so this is a lower bound until the last cell
+        bytes = patternsBytes + (size_t)(cell_i + 1) * librif_cell_index_size(numberOfPatterns);
+        
+        if(cellIndexes != NULL){
+            cellIndexes[cell_i] = patternIndex;
+        }
+        
+        if(limit > 0 && bytes > limit){
+            bytes = SIZE_MAX;
+            break;
+        }
+    }
+    
+    librif_free(pattern);
+    librif_free(table.hashes);
+    librif_free(table.indexes);
+    
+    if(output != NULL && bytes != SIZE_MAX){
+        output->hasAlpha = source->hasAlpha;
+        output->width = source->width;
+        output->height = source->height;
+        
+        output->patternSize = patternSize;
+        output->numberOfPatterns = numberOfPatterns;
+        librif_cimage_select_get_pixel(output);
+        output->cellCols = cellCols;
+        output->cellRows = cellRows;
+        output->numberOfCells = numberOfCells;
+        output->cellIndexSize = librif_cell_index_size(numberOfPatterns);
+        output->fileCellIndexSize = output->cellIndexSize;
+        
+        size_t patternsSizeInBytes = numberOfPatterns * patternSizeInBytes;
+        
+        output->patterns = librif_realloc(patterns, patternsSizeInBytes > 0 ? patternsSizeInBytes : 1);
+        output->cells = librif_malloc(numberOfCells * output->cellIndexSize);
+        
+        for(unsigned int i = 0; i < numberOfCells; i++){
+            switch(output->cellIndexSize){
+                case 1:
+                    output->cells[i] = cellIndexes[i];
+                    break;
+                case 2:
+                    ((uint16_t*)output->cells)[i] = cellIndexes[i];
+                    break;
+                default:
+                    ((uint32_t*)output->cells)[i] = cellIndexes[i];
+                    break;
+            }
+        }
+        
+        output->patternsReadBytes = patternsSizeInBytes;
+        output->patternsTotalBytes = patternsSizeInBytes;
+        output->cellsRead = numberOfCells;
+        
+        output->readBytes = patternsSizeInBytes + numberOfCells * output->cellIndexSize;
+        output->totalBytes = output->readBytes;
+    }
+    else {
+        librif_free(patterns);
+    }
+    
+    if(cellIndexes != NULL){
+        librif_free(cellIndexes);
+    }
+    
+    return bytes;
+}
+
+RIF_CImage* librif_image_compress(RIF_Image *source, const RIF_EncodeOptions *options){
+    
+    unsigned int patternMin = 8;
+    unsigned int patternMax = 8;
+    unsigned int patternStep = 2;
+    
+    if(options != NULL){
+        patternMin = options->patternMin;
+        patternMax = options->patternMax;
+        patternStep = options->patternStep;
+    }
+    
+    if(source->pixels == NULL || source->readBytes < source->totalBytes || patternMin == 0 || patternStep == 0){
+        return NULL;
+    }
+    
+    // same search order as encoder.py, ties are won by the smaller size
+    unsigned int safeMax = patternMax < (unsigned int)source->width ? patternMax : (unsigned int)source->width;
+    if(safeMax < patternMin){
+        safeMax = patternMin;
+    }
+    
+    unsigned int bestSize = 0;
+    size_t bestBytes = 0;
+    
+    for(unsigned int k = patternMin; k <= safeMax; k += patternStep){
+        unsigned int patternSize = safeMax - (k - patternMin);
+        
+        size_t bytes = librif_compress_with_size(source, patternSize, bestBytes, NULL);
+        
+        if(bytes != SIZE_MAX && (bestSize == 0 || bytes <= bestBytes)){
+            bestSize = patternSize;
+            bestBytes = bytes;
+        }
+    }
+    
+    RIF_CImage *image = librif_cimage_base(NULL);
+    librif_compress_with_size(source, bestSize, 0, image);
+    
+    return image;
+}
+
+bool librif_cimage_write(RIF_CImage *image, const char *filename){
+    
+    if(image->cellsRead < (int)image->numberOfCells){
+        return false;
+    }
+    
+    #ifdef RIF_PLAYDATE
+    SDFile *file = RIF_pd->file->open(filename, kFileWrite);
+    #else
+    FILE *file = fopen(filename, "wb");
+    #endif
+    
+    if(file == NULL){
+        return false;
+    }
+    
+    // indexes are written with the smallest size that fits
+    unsigned int cellIndexSize = librif_cell_index_size(image->numberOfPatterns);
+    
+    uint8_t header[25];
+    header[0] = (image->hasAlpha ? alphaFlag : 0) | librif_cell_index_flags(cellIndexSize);
+    
+    uint32_t values[6] = { image->width, image->height, image->cellCols, image->cellRows, image->patternSize, image->numberOfPatterns };
+    for(int i = 0; i < 6; i++){
+        librif_uint32_to_bytes(values[i], &header[1 + i * 4]);
+    }
+    
+    size_t patternSizeInBytes = get_pixels_size_in_bytes(image->patternSize, image->patternSize, image->hasAlpha);
+    size_t patternsSizeInBytes = image->numberOfPatterns * patternSizeInBytes;
+    
+    bool success = true;
+    
+    #ifdef RIF_PLAYDATE
+    success &= RIF_pd->file->write(file, header, sizeof(header)) == sizeof(header);
+    success &= RIF_pd->file->write(file, image->patterns, (unsigned int)patternsSizeInBytes) == (int)patternsSizeInBytes;
+    #else
+    success &= fwrite(header, 1, sizeof(header), file) == sizeof(header);
+    success &= fwrite(image->patterns, 1, patternsSizeInBytes, file) == patternsSizeInBytes;
+    #endif
+    
+    int bufferCells = RIF_CELLS_BUFFER_SIZE / cellIndexSize;
+    
+    for(unsigned int start = 0; start < image->numberOfCells && success; start += bufferCells){
+        
+        unsigned int count = image->numberOfCells - start;
+        if(count > (unsigned int)bufferCells){
+            count = bufferCells;
+        }
+        
+        for(unsigned int i = 0; i < count; i++){
+            uint32_t patternIndex = librif_cimage_get_pattern_index(image, start + i);
+            uint8_t *bytes = &image->cellsBuffer[i * cellIndexSize];
+            
+            if(cellIndexSize == 1){
+                bytes[0] = patternIndex;
+            }
+            else if(cellIndexSize == 2){
+                bytes[0] = patternIndex >> 8;
+                bytes[1] = patternIndex;
+            }
+            else {
+                librif_uint32_to_bytes(patternIndex, bytes);
+            }
+        }
+        
+        size_t bufferSize = count * cellIndexSize;
+        
+        #ifdef RIF_PLAYDATE
+        success &= RIF_pd->file->write(file, image->cellsBuffer, (unsigned int)bufferSize) == (int)bufferSize;
+        #else
+        success &= fwrite(image->cellsBuffer, 1, bufferSize, file) == bufferSize;
+        #endif
+    }
+    
+    #ifdef RIF_PLAYDATE
+    RIF_pd->file->close(file);
+    #else
+    success &= fclose(file) == 0;
+    #endif
+    
+    return success;
+}
+
+static size_t get_pixels_size_in_bytes(int width, int height, bool alpha){
+    size_t numberOfPixels = (size_t)width * height;
+    size_t size;
+    if(alpha){
+        size = numberOfPixels * sizeof(uint8_t) * 2;
+    }
+    else {
+        size = numberOfPixels * sizeof(uint8_t);
+    }
+    return size;
+}
+
+static uint32_t librif_uint32_from_bytes(const uint8_t *bytes){
+    return (uint32_t)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+}
+
+static void librif_uint32_to_bytes(uint32_t value, uint8_t *bytes){
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+}
+
+// I/O
+
+#ifdef RIF_PLAYDATE
+static size_t librif_io_file_read(void *context, void *buffer, size_t size){
+    int result = RIF_pd->file->read(context, buffer, (unsigned int)size);
+    return (result > 0) ? result : 0;
+}
+
+static bool librif_io_file_seek(void *context, size_t offset){
+    return RIF_pd->file->seek(context, (int)offset, SEEK_SET) == 0;
+}
+
+static size_t librif_io_file_size(void *context){
+    int position = RIF_pd->file->tell(context);
+    RIF_pd->file->seek(context, 0, SEEK_END);
+    int size = RIF_pd->file->tell(context);
+    RIF_pd->file->seek(context, position, SEEK_SET);
+    return (size > 0) ? size : 0;
+}
+
+static void librif_io_file_close(void *context){
+    RIF_pd->file->close(context);
+}
+
+static bool librif_io_file(RIF_IO *io, const char *filename){
+    SDFile *file = RIF_pd->file->open(filename, kFileRead);
+    if(file == NULL){
+        return false;
+    }
+#else
+static size_t librif_io_file_read(void *context, void *buffer, size_t size){
+    return fread(buffer, 1, size, context);
+}
+
+static bool librif_io_file_seek(void *context, size_t offset){
+    return fseek(context, (long)offset, SEEK_SET) == 0;
+}
+
+static size_t librif_io_file_size(void *context){
+    long position = ftell(context);
+    fseek(context, 0, SEEK_END);
+    long size = ftell(context);
+    fseek(context, position, SEEK_SET);
+    return (size > 0) ? size : 0;
+}
+
+static void librif_io_file_close(void *context){
+    fclose(context);
+}
+
+static bool librif_io_file(RIF_IO *io, const char *filename){
+    FILE *file = fopen(filename, "rb");
+    if(file == NULL){
+        return false;
+    }
+#endif
+    io->context = file;
+    io->read = librif_io_file_read;
+    io->seek = librif_io_file_seek;
+    io->size = librif_io_file_size;
+    io->close = librif_io_file_close;
+    return true;
+}
+
+// the io is closed if it can't hold minSize bytes
+static bool librif_io_begin(RIF_IO *io, size_t minSize){
+    
+    if(io->read == NULL){
+        if(io->close != NULL){
+            io->close(io->context);
+        }
+        return false;
+    }
+    
+    if((io->seek != NULL && !io->seek(io->context, 0)) || !librif_io_has_bytes(io, minSize)){
+        if(io->close != NULL){
+            io->close(io->context);
+        }
+        return false;
+    }
+    
+    return true;
+}
+
+// sources without a size are trusted
+static bool librif_io_has_bytes(RIF_IO *io, size_t size){
+    return (io->size == NULL || io->size(io->context) >= size);
+}
+
+static size_t librif_io_read(RIF_IO *io, void *buffer, size_t size){
+    RIF_TRACE_COUNT_READ();
+    return io->read(io->context, buffer, size);
+}
+
+static void librif_io_close(RIF_IO *io, bool *hasIO){
+    if(*hasIO && io->close != NULL){
+        io->close(io->context);
+    }
+    *hasIO = false;
+}
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t position;
+} RIF_MemoryIO;
+
+static size_t librif_io_memory_read(void *context, void *buffer, size_t size){
+    RIF_MemoryIO *memory = context;
+    size_t available = memory->size - memory->position;
+    if(size > available){
+        size = available;
+    }
+    memcpy(buffer, &memory->data[memory->position], size);
+    memory->position += size;
+    return size;
+}
+
+static bool librif_io_memory_seek(void *context, size_t offset){
+    RIF_MemoryIO *memory = context;
+    if(offset > memory->size){
+        return false;
+    }
+    memory->position = offset;
+    return true;
+}
+
+static size_t librif_io_memory_size(void *context){
+    RIF_MemoryIO *memory = context;
+    return memory->size;
+}
+
+static void librif_io_memory_close(void *context){
+    librif_free(context);
+}
+
+RIF_IO librif_io_memory(const void *data, size_t size){
+    
+    RIF_IO io = { 0 };
+    
+    // without a context the source has no read function and opens fail
+    RIF_MemoryIO *memory = librif_malloc(sizeof(RIF_MemoryIO));
+    if(memory == NULL){
+        return io;
+    }
+    
+    memory->data = data;
+    memory->size = size;
+    memory->position = 0;
+    
+    io.context = memory;
+    io.read = librif_io_memory_read;
+    io.seek = librif_io_memory_seek;
+    io.size = librif_io_memory_size;
+    io.close = librif_io_memory_close;
+    return io;
+}
+
+#ifndef RIF_PLAYDATE
+typedef struct {
+    int fd;
+    size_t offset;
+    size_t size;
+    size_t position;
+} RIF_FileDescriptorIO;
+
+static size_t librif_io_fd_read(void *context, void *buffer, size_t size){
+    RIF_FileDescriptorIO *file = context;
+    
+    size_t available = file->size - file->position;
+    if(size > available){
+        size = available;
+    }
+    
+    size_t readBytes = 0;
+    while(readBytes < size){
+        ssize_t result = pread(file->fd, (uint8_t*)buffer + readBytes, size - readBytes, (off_t)(file->offset + file->position + readBytes));
+        if(result < 0 && errno == EINTR){
+            continue;
+        }
+        if(result <= 0){
+            break;
+        }
+        readBytes += result;
+    }
+    
+    file->position += readBytes;
+    return readBytes;
+}
+
+static bool librif_io_fd_seek(void *context, size_t offset){
+    RIF_FileDescriptorIO *file = context;
+    if(offset > file->size){
+        return false;
+    }
+    file->position = offset;
+    return true;
+}
+
+static size_t librif_io_fd_size(void *context){
+    RIF_FileDescriptorIO *file = context;
+    return file->size;
+}
+
+static void librif_io_fd_close(void *context){
+    // the descriptor belongs to the caller
+    librif_free(context);
+}
+
+RIF_IO librif_io_fd(int fd, size_t offset, size_t size){
+    
+    if(size == 0){
+        struct stat fileStat;
+        if(fstat(fd, &fileStat) == 0 && (size_t)fileStat.st_size > offset){
+            size = fileStat.st_size - offset;
+        }
+    }
+    
+    RIF_IO io = { 0 };
+    
+    RIF_FileDescriptorIO *file = librif_malloc(sizeof(RIF_FileDescriptorIO));
+    if(file == NULL){
+        return io;
+    }
+    
+    file->fd = fd;
+    file->offset = offset;
+    file->size = size;
+    file->position = 0;
+    
+    io.context = file;
+    io.read = librif_io_fd_read;
+    io.seek = librif_io_fd_seek;
+    io.size = librif_io_fd_size;
+    io.close = librif_io_fd_close;
+    return io;
+}
+#endif
+
+// header fields are read into local buffers, so opens on different threads don't share state,
+// false if the source ends before the field
+static bool librif_read_uint8(RIF_Image *image, uint8_t *value){
+    return librif_io_read(&image->io, value, 1) == 1;
+}
+
+static bool librif_read_uint32(RIF_Image *image, uint32_t *value){
+    uint8_t bytes[4];
+    if(librif_io_read(&image->io, bytes, 4) != 4){
+        return false;
+    }
+    *value = librif_uint32_from_bytes(bytes);
+    return true;
+}
+
+static bool librifc_read_uint8(RIF_CImage *image, uint8_t *value){
+    return librif_io_read(&image->io, value, 1) == 1;
+}
+
+static bool librifc_read_uint32(RIF_CImage *image, uint32_t *value){
+    uint8_t bytes[4];
+    if(librif_io_read(&image->io, bytes, 4) != 4){
+        return false;
+    }
+    *value = librif_uint32_from_bytes(bytes);
+    return true;
+}
+
+void librif_image_free(RIF_Image *image){
+    
+    // freed before the end of the data
+    librif_io_close(&image->io, &image->hasIO);
+    
+    #ifndef RIF_PLAYDATE
+    if(image->inPlace){
+        if(image->mapAddress != NULL){
+            munmap(image->mapAddress, image->mapSize);
+        }
+        librif_free(image);
+        return;
+    }
+    #endif
+    
+    if(image->pool == NULL){
+        librif_free(image->pixels);
+        librif_free(image);
+    }
+}
+
+// frees an image that failed to open, pool memory allocated after mark is released
+static void librif_image_discard(RIF_Image *image, RIF_PoolMark mark){
+    
+    librif_io_close(&image->io, &image->hasIO);
+    
+    if(image->pool != NULL){
+        librif_pool_rewind(image->pool, mark);
+    }
+    else {
+        librif_free(image->pixels);
+        librif_free(image);
+    }
+}
+
+void librif_cimage_free(RIF_CImage *image){
+	
+    librif_io_close(&image->io, &image->hasIO);
+    
+    if(image->ditheredPatterns != NULL){
+        librif_free(image->ditheredPatterns);
+    }
+    if(image->ditheredMasks != NULL){
+        librif_free(image->ditheredMasks);
+    }
+    
+    #ifndef RIF_PLAYDATE
+    if(image->inPlace){
+        if(image->mapAddress != NULL){
+            munmap(image->mapAddress, image->mapSize);
+        }
+        librif_free(image);
+        return;
+    }
+    #endif
+    
+    if(image->pool == NULL){
+        librif_free(image->patterns);
+        librif_free(image->cells);
+        librif_free(image);
+    }
+}
+
+static void librif_cimage_discard(RIF_CImage *image, RIF_PoolMark mark){
+    
+    librif_io_close(&image->io, &image->hasIO);
+    
+    if(image->pool != NULL){
+        librif_pool_rewind(image->pool, mark);
+    }
+    else {
+        librif_free(image->patterns);
+        librif_free(image->cells);
+        librif_free(image);
+    }
+}
+
+RIF_Pool* librif_pool_new(size_t size){
+    RIF_TRACE_BEGIN(RIF_TracePoolNew);
+    
+    void *ptr = librif_malloc(size);
+    RIF_Pool *pool = librif_malloc(sizeof(RIF_Pool));
+    
+    if((ptr == NULL && size > 0) || pool == NULL){
+        librif_free(ptr);
+        librif_free(pool);
+        RIF_TRACE_END(0);
+        return NULL;
+    }
+    
+    pool->size = size;
+    pool->startAddress = ptr;
+    pool->address = ptr;
+    pool->usedAddress = ptr;
+    pool->clearMemory = false;
+    
+    RIF_TRACE_END(size);
+    return pool;
+}
+
+static size_t librif_pool_align(size_t offset){
+    return (offset + (RIF_POOL_ALIGNMENT - 1)) & ~(size_t)(RIF_POOL_ALIGNMENT - 1);
+}
+
+// returns NULL and leaves the pool unchanged if there isn't enough space
+void* librif_pool_alloc(RIF_Pool *pool, size_t size){
+    
+    RIF_TRACE_BEGIN(RIF_TracePoolAlloc);
+    
+    uint8_t *ptr = NULL;
+    
+    size_t offset = librif_pool_align(pool->address - pool->startAddress);
+    if(offset <= pool->size && size <= (pool->size - offset)){
+        ptr = pool->startAddress + offset;
+        pool->address = ptr + size;
+        
+        if(pool->address > pool->usedAddress){
+            pool->usedAddress = pool->address;
+        }
+    }
+    
+    RIF_TRACE_END(ptr ? size : 0);
+    return ptr;
+}
+
+RIF_PoolMark librif_pool_mark(RIF_Pool *pool){
+    return pool->address - pool->startAddress;
+}
+
+// memory allocated after mark is released, images using it must not be used anymore
+void librif_pool_rewind(RIF_Pool *pool, RIF_PoolMark mark){
+    
+    if(mark > (size_t)(pool->address - pool->startAddress)){
+        return;
+    }
+    
+    RIF_TRACE_BEGIN(RIF_TracePoolRewind);
+    
+    #ifdef RIF_TRACE
+    size_t releasedBytes = (pool->address - pool->startAddress) - mark;
+    #endif
+    
+    pool->address = pool->startAddress + mark;
+    
+    if(pool->clearMemory && pool->usedAddress > pool->address){
+        memset(pool->address, 0, pool->usedAddress - pool->address);
+        pool->usedAddress = pool->address;
+    }
+    
+    RIF_TRACE_END(releasedBytes);
+}
+
+void librif_pool_clear(RIF_Pool *pool){
+    librif_pool_rewind(pool, 0);
+}
+
+// the pool can move, images opened in it must be cleared first
+void librif_pool_realloc(RIF_Pool *pool, size_t size){
+    
+    RIF_TRACE_BEGIN(RIF_TracePoolRealloc);
+    
+    size_t offset = pool->address - pool->startAddress;
+    size_t usedOffset = pool->usedAddress - pool->startAddress;
+    
+    // the pool is left unchanged if it can't be resized
+    uint8_t *startAddress = librif_realloc(pool->startAddress, size > 0 ? size : 1);
+    if(startAddress == NULL){
+        RIF_TRACE_END(0);
+        return;
+    }
+    
+    pool->startAddress = startAddress;
+    pool->size = size;
+    
+    pool->address = startAddress + ((offset < size) ? offset : size);
+    pool->usedAddress = startAddress + ((usedOffset < size) ? usedOffset : size);
+    
+    RIF_TRACE_END(size);
+}
+
+void librif_pool_free(RIF_Pool *pool){
+    RIF_TRACE_BEGIN(RIF_TracePoolFree);
+    
+    #ifdef RIF_TRACE
+    size_t size = pool->size;
+    #endif
+    
+    librif_free(pool->startAddress);
+    librif_free(pool);
+    
+    RIF_TRACE_END(size);
+}
+
+// pool space needed by librif_image_open or librif_cimage_open, only the header is read.
+// the kind is passed because flags 0 and 1 of a compressed file are also valid raw headers,
+// returns 0 if the file can't be read or its header is invalid
+size_t librif_pool_required_size(const char *filename, bool compressed){
+    
+    RIF_IO io;
+    if(!librif_io_file(&io, filename)){
+        return 0;
+    }
+    
+    // large enough for both headers, see cheaderSizeInBytes
+    uint8_t header[25];
+    size_t readSize = io.read(io.context, header, cheaderSizeInBytes);
+    io.close(io.context);
+    
+    if(!compressed){
+        if(readSize < headerSizeInBytes){
+            return 0;
+        }
+        
+        bool hasAlpha = (header[0] == 1) ? true : false;
+        uint32_t width = librif_uint32_from_bytes(&header[1]);
+        uint32_t height = librif_uint32_from_bytes(&header[5]);
+        
+        // same limits as librif_image_open, with room for the alignment
+        if(width > INT32_MAX || height > INT32_MAX || (height != 0 && width > (SIZE_MAX / 4) / height)){
+            return 0;
+        }
+        
+        return librif_pool_align(sizeof(RIF_Image)) + librif_pool_align(get_pixels_size_in_bytes(width, height, hasAlpha));
+    }
+    
+    if(readSize < cheaderSizeInBytes){
+        return 0;
+    }
+    
+    bool hasAlpha = (header[0] & alphaFlag) ? true : false;
+    unsigned int fileCellIndexSize = librif_cell_index_size_from_flags(header[0]);
+    
+    uint32_t cx = librif_uint32_from_bytes(&header[9]);
+    uint32_t cy = librif_uint32_from_bytes(&header[13]);
+    uint32_t patternSize = librif_uint32_from_bytes(&header[17]);
+    uint32_t numberOfPatterns = librif_uint32_from_bytes(&header[21]);
+    
+    // headers rejected by librif_cimage_open need no pool, the check also bounds the sizes below
+    if(!librif_cimage_check_header(librif_uint32_from_bytes(&header[1]), librif_uint32_from_bytes(&header[5]), cx, cy, patternSize, numberOfPatterns, hasAlpha, fileCellIndexSize, SIZE_MAX / 2)){
+        return 0;
+    }
+    
+    size_t numberOfCells = (size_t)cx * cy;
+    
+    // same index size as librif_cimage_open_io
+    unsigned int cellIndexSize = librif_cell_index_size(numberOfPatterns);
+    if(cellIndexSize > fileCellIndexSize){
+        cellIndexSize = fileCellIndexSize;
+    }
+    
+    size_t cellsSizeInBytes = numberOfCells * cellIndexSize;
+    size_t patternsSizeInBytes = (size_t)numberOfPatterns * get_pixels_size_in_bytes(patternSize, patternSize, hasAlpha);
+    
+    return librif_pool_align(sizeof(RIF_CImage)) + librif_pool_align(cellsSizeInBytes) + librif_pool_align(patternsSizeInBytes);
+}
+
+// librif_malloc and librif_realloc calls
+static size_t librif_allocations = 0;
+
+size_t librif_allocation_count(void){
+    #ifdef RIF_PLAYDATE
+    return librif_allocations;
+    #else
+    return __atomic_load_n(&librif_allocations, __ATOMIC_RELAXED);
+    #endif
+}
+
+#ifdef RIF_PLAYDATE
+
+static void* librif_malloc(size_t size){
+    RIF_TRACE_COUNT_ALLOCATION();
+    librif_allocations++;
+    return RIF_pd->system->realloc(NULL, size);
+}
+
+static void* librif_realloc(void *ptr, size_t size){
+    RIF_TRACE_COUNT_ALLOCATION();
+    librif_allocations++;
+    return RIF_pd->system->realloc(ptr, size);
+}
+
+static void librif_free(void *ptr){
+    RIF_pd->system->realloc(ptr, 0);
+}
+
+#else
+
+static void* librif_malloc(size_t size){
+    RIF_TRACE_COUNT_ALLOCATION();
+    __atomic_fetch_add(&librif_allocations, 1, __ATOMIC_RELAXED);
+    return malloc(size);
+}
+
+static void* librif_realloc(void *ptr, size_t size){
+    RIF_TRACE_COUNT_ALLOCATION();
+    __atomic_fetch_add(&librif_allocations, 1, __ATOMIC_RELAXED);
+    return realloc(ptr, size);
+}
 
 static void librif_free(void *ptr){
     free(ptr);
 }
 
 #endif
+
+//
+// Time budget
+//
+
+// the Playdate clock counts milliseconds
+#ifdef RIF_PLAYDATE
+static const uint64_t timeResolution = 1000;
+#else
+static const uint64_t timeResolution = 1;
+#endif
+
+// first chunk of a budgeted call, before the rate is known
+static const size_t budgetProbeSize = 4096;
+// smallest chunk, so that every call makes progress
+static const size_t budgetMinSize = 512;
+
+// microseconds
+static uint64_t librif_time(void){
+    #ifdef RIF_PLAYDATE
+    return (uint64_t)RIF_pd->system->getCurrentTimeMilliseconds() * 1000;
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    #endif
+}
+
+// bytes expected to fit in microseconds, 0 if less than the minimum chunk
+static size_t librif_budget_size(float rate, uint64_t microseconds){
+    
+    if(rate <= 0){
+        return budgetProbeSize;
+    }
+    
+    // half of the time left, the next chunks are measured against the rate just seen
+    double size = (double)rate * microseconds * 0.5;
+    if(size < budgetMinSize){
+        return 0;
+    }
+    if(size > (double)(SIZE_MAX / 2)){
+        return SIZE_MAX / 2;
+    }
+    
+    return (size_t)size;
+}
+
+static void librif_budget_update(float *rate, size_t bytes, uint64_t elapsed){
+    
+    if(bytes == 0){
+        return;
+    }
+    
+    // below the resolution the chunk is counted as one tick
+    if(elapsed < timeResolution){
+        elapsed = timeResolution;
+    }
+    
+    float measured = (float)bytes / (float)elapsed;
+    *rate = (*rate > 0) ? (*rate + measured) * 0.5f : measured;
+}
+
+static bool librif_read_budget_base(RIF_Image *image, RIF_CImage *cimage, uint32_t microseconds, bool *closed){
+    
+    bool isClosed = false;
+    
+    size_t startBytes = (image != NULL) ? image->readBytes : cimage->readBytes;
+    uint64_t start = librif_time();
+    
+    while(!isClosed){
+        
+        size_t readBytes = (image != NULL) ? image->readBytes : cimage->readBytes;
+        
+        float *rate;
+        if(image != NULL){
+            rate = &image->budgetRate;
+        }
+        else {
+            rate = (cimage->patternsReadBytes < cimage->patternsTotalBytes) ? &cimage->patternsBudgetRate : &cimage->cellsBudgetRate;
+        }
+        
+        uint64_t elapsed = librif_time() - start;
+        size_t size = librif_budget_size(*rate, microseconds - (elapsed < microseconds ? elapsed : microseconds));
+        
+        if(size == 0){
+            if(readBytes > startBytes){
+                break;
+            }
+            // at least one chunk per call
+            size = budgetMinSize;
+        }
+        
+        uint64_t chunkStart = librif_time();
+        
+        bool success = (image != NULL) ? librif_image_read(image, size, &isClosed) : librif_cimage_read(cimage, size, &isClosed);
+        if(!success){
+            return false;
+        }
+        
+        size_t chunkBytes = ((image != NULL) ? image->readBytes : cimage->readBytes) - readBytes;
+        librif_budget_update(rate, chunkBytes, librif_time() - chunkStart);
+    }
+    
+    if(closed != NULL){
+        *closed = isClosed;
+    }
+    
+    return true;
+}
+
+#ifdef RIF_TRACE
+//
+// Tracing
+//
+
+typedef struct {
+    RIF_TracePhase phase;
+    unsigned int thread;
+    uint64_t start;
+    uint64_t duration;
+    uint64_t bytes;
+    unsigned int reads;
+    unsigned int allocations;
+} RIF_TraceEvent;
+
+static const char *librif_trace_names[RIF_TracePhaseCount] = {
+    "librif_image_open",
+    "librif_image_read",
+    "librif_cimage_open",
+    "librif_cimage_read_patterns",
+    "librif_cimage_read_cells",
+    "librif_cimage_decompress",
+    "librif_pool_new",
+    "librif_pool_alloc",
+    "librif_pool_rewind",
+    "librif_pool_realloc",
+    "librif_pool_free"
+};
+
+static RIF_TraceSummary librif_trace_summary = { 0 };
+
+// allocated with the system allocator, so it doesn't show up in the counts
+static RIF_TraceEvent *librif_trace_events = NULL;
+static size_t librif_trace_numberOfEvents = 0;
+
+#ifdef RIF_PLAYDATE
+static unsigned int librif_trace_reads = 0;
+static unsigned int librif_trace_allocations = 0;
+#else
+// counted per thread, so concurrent loads don't add to each other's calls
+static __thread unsigned int librif_trace_reads = 0;
+static __thread unsigned int librif_trace_allocations = 0;
+static __thread unsigned int librif_trace_thread = 0;
+static unsigned int librif_trace_threads = 0;
+static pthread_mutex_t librif_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void librif_trace_lock(void){
+    #ifndef RIF_PLAYDATE
+    pthread_mutex_lock(&librif_trace_mutex);
+    #endif
+}
+
+static void librif_trace_unlock(void){
+    #ifndef RIF_PLAYDATE
+    pthread_mutex_unlock(&librif_trace_mutex);
+    #endif
+}
+
+static void librif_trace_count(bool read){
+    if(read){
+        librif_trace_reads++;
+    }
+    else {
+        librif_trace_allocations++;
+    }
+}
+
+static void librif_trace_begin(RIF_TraceScope *scope, RIF_TracePhase phase){
+    scope->phase = phase;
+    scope->reads = librif_trace_reads;
+    scope->allocations = librif_trace_allocations;
+    scope->start = librif_time();
+}
+
+static void librif_trace_end(RIF_TraceScope *scope, size_t bytes){
+    
+    RIF_TraceEvent event;
+    event.phase = scope->phase;
+    event.start = scope->start;
+    event.duration = librif_time() - scope->start;
+    event.bytes = bytes;
+    event.reads = librif_trace_reads - scope->reads;
+    event.allocations = librif_trace_allocations - scope->allocations;
+    
+    #ifdef RIF_PLAYDATE
+    event.thread = 1;
+    #else
+    if(librif_trace_thread == 0){
+        librif_trace_thread = __atomic_add_fetch(&librif_trace_threads, 1, __ATOMIC_RELAXED);
+    }
+    event.thread = librif_trace_thread;
+    #endif
+    
+    librif_trace_lock();
+    
+    RIF_TracePhaseSummary *phase = &librif_trace_summary.phases[event.phase];
+    phase->calls++;
+    phase->time += event.duration;
+    phase->bytes += event.bytes;
+    phase->reads += event.reads;
+    phase->allocations += event.allocations;
+    
+    if(librif_trace_events == NULL){
+        #ifdef RIF_PLAYDATE
+        librif_trace_events = RIF_pd->system->realloc(NULL, RIF_TRACE_MAX_EVENTS * sizeof(RIF_TraceEvent));
+        #else
+        librif_trace_events = malloc(RIF_TRACE_MAX_EVENTS * sizeof(RIF_TraceEvent));
+        #endif
+    }
+    
+    if(librif_trace_events != NULL && librif_trace_numberOfEvents < RIF_TRACE_MAX_EVENTS){
+        librif_trace_events[librif_trace_numberOfEvents++] = event;
+    }
+    else {
+        librif_trace_summary.droppedEvents++;
+    }
+    
+    librif_trace_unlock();
+}
+
+void librif_trace_reset(void){
+    librif_trace_lock();
+    memset(&librif_trace_summary, 0, sizeof(RIF_TraceSummary));
+    librif_trace_numberOfEvents = 0;
+    librif_trace_unlock();
+}
+
+RIF_TraceSummary librif_trace_get_summary(void){
+    librif_trace_lock();
+    RIF_TraceSummary summary = librif_trace_summary;
+    librif_trace_unlock();
+    return summary;
+}
+
+const char* librif_trace_phase_name(RIF_TracePhase phase){
+    if(phase < 0 || phase >= RIF_TracePhaseCount){
+        return NULL;
+    }
+    return librif_trace_names[phase];
+}
+
+bool librif_trace_write(const char *filename){
+    
+    #ifdef RIF_PLAYDATE
+    SDFile *file = RIF_pd->file->open(filename, kFileWrite);
+    #else
+    FILE *file = fopen(filename, "wb");
+    #endif
+    
+    if(file == NULL){
+        return false;
+    }
+    
+    bool success = true;
+    char line[256];
+    
+    librif_trace_lock();
+    
+    for(size_t i = 0; i <= librif_trace_numberOfEvents + 1; i++){
+        int length;
+        
+        if(i == 0){
+            length = snprintf(line, sizeof(line), "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        }
+        else if(i == librif_trace_numberOfEvents + 1){
+            length = snprintf(line, sizeof(line), "]}\n");
+        }
+        else {
+            RIF_TraceEvent *event = &librif_trace_events[i - 1];
+            // complete events, ts and dur in microseconds
+            length = snprintf(line, sizeof(line), "{\"name\":\"%s\",\"cat\":\"librif\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%llu,\"args\":{\"bytes\":%llu,\"reads\":%u,\"allocations\":%u}}%s\n",
+                              librif_trace_names[event->phase], event->thread, (unsigned long long)event->start, (unsigned long long)event->duration,
+                              (unsigned long long)event->bytes, event->reads, event->allocations, (i < librif_trace_numberOfEvents) ? "," : "");
+        }
+        
+        #ifdef RIF_PLAYDATE
+        success &= RIF_pd->file->write(file, line, (unsigned int)length) == length;
+        #else
+        success &= fwrite(line, 1, length, file) == (size_t)length;
+        #endif
+    }
+    
+    librif_trace_unlock();
+    
+    #ifdef RIF_PLAYDATE
+    RIF_pd->file->close(file);
+    #else
+    success &= (fclose(file) == 0);
+    #endif
+    
+    return success;
+}
+#endif
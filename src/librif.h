@@ -26,13 +26,63 @@
 extern PlaydateAPI *RIF_pd;
 #endif
 
+// scratch space used to decode cell indexes, in bytes
+#define RIF_CELLS_BUFFER_SIZE 4096
+
+// cells a row cursor holds without allocating, 512 pixels with 8x8 patterns
+#define RIF_ROW_SEGMENTS 64
+
+// stack space used by dither calls, in bytes, wider error diffusion rects allocate
+#ifndef RIF_DITHER_BUFFER_SIZE
+#define RIF_DITHER_BUFFER_SIZE 8192
+#endif
+
+typedef enum {
+    RIF_DitherThreshold,
+    RIF_DitherBayer2,
+    RIF_DitherBayer4,
+    RIF_DitherBayer8,
+    RIF_DitherFloydSteinberg,
+    RIF_DitherAtkinson
+} RIF_DitherMethod;
+
+// pool allocations are aligned to this size, relative to startAddress
+#define RIF_POOL_ALIGNMENT 16
+
 typedef struct {
     uint8_t *address;
     uint8_t *startAddress;
     size_t size;
+    // zero the released memory on clear and rewind, false by default
+    bool clearMemory;
+    // highest address reached since the memory was last zeroed
+    uint8_t *usedAddress;
 } RIF_Pool;
 
+// offset of the next allocation, see librif_pool_rewind
+typedef size_t RIF_PoolMark;
+
+// byte source of an image, see librif_image_open_io
 typedef struct {
+    void *context;
+    // returns the number of bytes read, fewer than size only at the end of the source
+    size_t (*read)(void *context, void *buffer, size_t size);
+    // optional, offset from the start of the image data
+    bool (*seek)(void *context, size_t offset);
+    // optional, size of the image data in bytes
+    size_t (*size)(void *context);
+    // optional, called once the image is read or freed
+    void (*close)(void *context);
+} RIF_IO;
+
+typedef struct RIF_Image RIF_Image;
+typedef struct RIF_CImage RIF_CImage;
+
+// get_pixel specialized at open, see librif_image_get_pixel
+typedef void (*RIF_ImageGetPixelFunction)(RIF_Image *image, int x, int y, uint8_t *color, uint8_t *alpha);
+typedef void (*RIF_CImageGetPixelFunction)(RIF_CImage *image, int x, int y, uint8_t *color, uint8_t *alpha);
+
+struct RIF_Image {
     uint8_t *pixels;
     
     bool hasAlpha;
@@ -40,20 +90,32 @@ typedef struct {
     int width;
     int height;
     
-	#ifdef RIF_PLAYDATE
-    SDFile *pd_file;
-	#else
-    FILE *file;
+    RIF_ImageGetPixelFunction getPixel;
+    
+    // open while there are bytes to read
+    RIF_IO io;
+    bool hasIO;
+    
+	#ifndef RIF_PLAYDATE
+    // pixels point into a mapping or a caller's buffer
+    bool inPlace;
+    // pixels are in a caller's buffer, which set_pixel doesn't write
+    bool readOnly;
+    void *mapAddress;
+    size_t mapSize;
 	#endif
     
     size_t totalBytes;
     size_t readBytes;
     
+    // bytes per microsecond measured by the _budget functions, 0 until the first call
+    float budgetRate;
+    
     RIF_Pool *pool;
-} RIF_Image;
+};
 
-typedef struct {
-    uint8_t **cells;
+struct RIF_CImage {
+    uint8_t *cells;
     uint8_t *patterns;
     
     bool hasAlpha;
@@ -62,18 +124,36 @@ typedef struct {
     int height;
     
     unsigned int patternSize;
+    // log2 of patternSize when it's a power of two
+    unsigned int patternShift;
     unsigned int numberOfPatterns;
     unsigned int cellCols;
     unsigned int cellRows;
     unsigned int numberOfCells;
+    unsigned int cellIndexSize;
+    unsigned int fileCellIndexSize;
+    
+    RIF_CImageGetPixelFunction getPixel;
+    
+    RIF_IO io;
+    bool hasIO;
     
-	#ifdef RIF_PLAYDATE
-    SDFile *pd_file;
-	#else
-    FILE *file;
+	#ifndef RIF_PLAYDATE
+    const uint8_t *cellIndexes;
+    
+    // patterns and indexes point into a mapping or a caller's buffer
+    bool inPlace;
+    void *mapAddress;
+    size_t mapSize;
 	#endif
     
     int cellsRead;
+    uint8_t cellsBuffer[RIF_CELLS_BUFFER_SIZE];
+    
+    // 1-bit patterns, see librif_cimage_dither_patterns
+    uint8_t *ditheredPatterns;
+    uint8_t *ditheredMasks;
+    RIF_DitherMethod ditherMethod;
 
     size_t patternsReadBytes;
     size_t patternsTotalBytes;
@@ -81,35 +161,228 @@ typedef struct {
     size_t readBytes;
     size_t totalBytes;
     
+    // measured separately, the cell table is decoded while it's read
+    float patternsBudgetRate;
+    float cellsBudgetRate;
+    
     RIF_Pool *pool;
-} RIF_CImage;
+};
+
+typedef enum {
+    RIF_PixelFormatColor,
+    RIF_PixelFormatColorAlpha
+} RIF_PixelFormat;
+
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} RIF_Rect;
+
+// row cursor over a RIF_CImage, see librif_cimage_row_begin
+typedef struct {
+    RIF_CImage *image;
+    RIF_PixelFormat format;
+    
+    int y;
+    int left;
+    int count;
+    int right;
+    
+    int firstCellCol;
+    int firstPatternX;
+    
+    // pattern rows of the current cell row, advanced by rowOffset
+    int cellRow;
+    size_t rowOffset;
+    const uint8_t **segments;
+    int numberOfSegments;
+    
+    // segments point here unless the row crosses more cells, so a cursor can't be copied
+    const uint8_t *segmentsBuffer[RIF_ROW_SEGMENTS];
+} RIF_CImageRow;
+
+typedef enum {
+    RIF_WrapClamp,
+    RIF_WrapRepeat,
+    RIF_WrapFill
+} RIF_WrapMode;
 
+typedef enum {
+    RIF_FilterNearest,
+    RIF_FilterBilinear
+} RIF_Filter;
+
+#ifndef RIF_PLAYDATE
+typedef enum {
+    RIF_AsyncLoading,
+    RIF_AsyncDone,
+    RIF_AsyncFailed
+} RIF_AsyncState;
+
+// image loaded on a worker thread, see librif_image_open_async
+typedef struct RIF_AsyncLoad RIF_AsyncLoad;
+
+// called on the worker thread when the load is done or failed,
+// it may take the image and free the load
+typedef void (*RIF_AsyncCallback)(RIF_AsyncLoad *load, void *userdata);
+#endif
+
+// tracing is compiled in when RIF_TRACE is defined for librif and its users
+#ifdef RIF_TRACE
+
+// events kept for librif_trace_write, the summary counts every call
+#ifndef RIF_TRACE_MAX_EVENTS
+#define RIF_TRACE_MAX_EVENTS 16384
+#endif
+
+typedef enum {
+    RIF_TraceImageOpen,
+    RIF_TraceImageRead,
+    RIF_TraceCImageOpen,
+    RIF_TraceCImagePatterns,
+    RIF_TraceCImageCells,
+    RIF_TraceDecompress,
+    RIF_TracePoolNew,
+    RIF_TracePoolAlloc,
+    RIF_TracePoolRewind,
+    RIF_TracePoolRealloc,
+    RIF_TracePoolFree,
+    RIF_TracePhaseCount
+} RIF_TracePhase;
+
+// totals of a phase, nested calls are included in the time, reads and allocations of the caller
+typedef struct {
+    unsigned int calls;
+    // microseconds
+    uint64_t time;
+    uint64_t bytes;
+    // calls to RIF_IO read
+    unsigned int reads;
+    unsigned int allocations;
+} RIF_TracePhaseSummary;
+
+typedef struct {
+    RIF_TracePhaseSummary phases[RIF_TracePhaseCount];
+    // events not kept once RIF_TRACE_MAX_EVENTS is reached
+    unsigned int droppedEvents;
+} RIF_TraceSummary;
+#endif
+
+typedef struct {
+    unsigned int patternMin;
+    unsigned int patternMax;
+    unsigned int patternStep;
+} RIF_EncodeOptions;
+
+// call once before anything else, other calls are thread-safe across different images
 #ifdef RIF_PLAYDATE
 void librif_init(PlaydateAPI *pd);
 #else
 void librif_init(void);
 #endif
 
+// NULL if the pool can't be allocated, realloc leaves the pool unchanged on failure
 RIF_Pool* librif_pool_new(size_t size);
+void* librif_pool_alloc(RIF_Pool *pool, size_t size);
+RIF_PoolMark librif_pool_mark(RIF_Pool *pool);
+void librif_pool_rewind(RIF_Pool *pool, RIF_PoolMark mark);
 void librif_pool_realloc(RIF_Pool *pool, size_t size);
 void librif_pool_clear(RIF_Pool *pool);
 void librif_pool_free(RIF_Pool *pool);
+// pool space to open filename as a raw or compressed image, 0 if the header is invalid
+size_t librif_pool_required_size(const char *filename, bool compressed);
+
+// number of heap allocations made by librif, pooled open, read and decompress make none
+size_t librif_allocation_count(void);
 
 RIF_Image* librif_image_open(const char *filename, RIF_Pool *pool);
+RIF_Image* librif_image_open_io(RIF_IO io, RIF_Pool *pool);
 bool librif_image_read(RIF_Image *image, size_t size, bool *closed);
+bool librif_image_read_budget(RIF_Image *image, uint32_t microseconds, bool *closed);
+
+#ifndef RIF_PLAYDATE
+RIF_Image* librif_image_open_mapped(const char *filename);
+RIF_Image* librif_image_open_memory(const void *data, size_t size);
+#endif
 
 void librif_image_get_pixel(RIF_Image *image, int x, int y, uint8_t *color, uint8_t *alpha);
+void librif_image_get_pixel_generic(RIF_Image *image, int x, int y, uint8_t *color, uint8_t *alpha);
+// does nothing on images opened with librif_image_open_memory
 void librif_image_set_pixel(RIF_Image *image, int x, int y, uint8_t color, uint8_t alpha);
 
+void librif_image_copy_rect(RIF_Image *image, int x, int y, int width, int height, uint8_t *dst, size_t dstStride, RIF_PixelFormat format);
+bool librif_image_dither(RIF_Image *image, RIF_Rect rect, RIF_DitherMethod method, uint8_t *dst, size_t dstStride, uint8_t *mask, size_t maskStride);
+void librif_image_sample_affine_row(RIF_Image *image, int32_t u0, int32_t v0, int32_t du, int32_t dv, int count, RIF_WrapMode wrapMode, RIF_Filter filter, uint8_t *out, RIF_PixelFormat format);
+
+RIF_Image* librif_image_new(int width, int height);
 RIF_Image* librif_image_copy(RIF_Image *source);
 
 void librif_image_free(RIF_Image *image);
 
 RIF_CImage* librif_cimage_open(const char *filename, RIF_Pool *pool);
+RIF_CImage* librif_cimage_open_io(RIF_IO io, RIF_Pool *pool);
 bool librif_cimage_read(RIF_CImage *image, size_t size, bool *closed);
+bool librif_cimage_read_budget(RIF_CImage *image, uint32_t microseconds, bool *closed);
 void librif_cimage_get_pixel(RIF_CImage *image, int x, int y, uint8_t *color, uint8_t *alpha);
+void librif_cimage_get_pixel_generic(RIF_CImage *image, int x, int y, uint8_t *color, uint8_t *alpha);
+void librif_cimage_copy_rect(RIF_CImage *image, int x, int y, int width, int height, uint8_t *dst, size_t dstStride, RIF_PixelFormat format);
+bool librif_cimage_dither(RIF_CImage *image, RIF_Rect rect, RIF_DitherMethod method, uint8_t *dst, size_t dstStride, uint8_t *mask, size_t maskStride);
+bool librif_cimage_dither_patterns(RIF_CImage *image, RIF_DitherMethod method);
+void librif_cimage_sample_affine_row(RIF_CImage *image, int32_t u0, int32_t v0, int32_t du, int32_t dv, int count, RIF_WrapMode wrapMode, RIF_Filter filter, uint8_t *out, RIF_PixelFormat format);
+
+RIF_CImageRow* librif_cimage_row_begin(RIF_CImage *image, int y, int x0, int x1, RIF_PixelFormat format);
+bool librif_cimage_row_next(RIF_CImageRow *row, uint8_t *out);
+void librif_cimage_row_free(RIF_CImageRow *row);
+// cursor in caller storage, allocates only for rows crossing more than RIF_ROW_SEGMENTS cells
+bool librif_cimage_row_init(RIF_CImageRow *row, RIF_CImage *image, int y, int x0, int x1, RIF_PixelFormat format);
+void librif_cimage_row_release(RIF_CImageRow *row);
+
+#ifndef RIF_PLAYDATE
+RIF_CImage* librif_cimage_open_mapped(const char *filename);
+RIF_CImage* librif_cimage_open_memory(const void *data, size_t size);
+#endif
+
+// sources that failed to allocate have no read function, opening them fails
+RIF_IO librif_io_memory(const void *data, size_t size);
+#ifndef RIF_PLAYDATE
+RIF_IO librif_io_fd(int fd, size_t offset, size_t size);
+#endif
 
 RIF_Image* librif_cimage_decompress(RIF_CImage *cimage, RIF_Pool *pool);
+// open and decompress in one pass, only the patterns are kept in memory while loading
+RIF_Image* librif_cimage_open_decompressed(const char *filename, RIF_Pool *pool);
+RIF_Image* librif_cimage_open_decompressed_io(RIF_IO io, RIF_Pool *pool);
+// incremental decompression, rows are written by librif_cimage_decompress_budget
+RIF_Image* librif_cimage_decompress_begin(RIF_CImage *cimage, RIF_Pool *pool);
+bool librif_cimage_decompress_budget(RIF_CImage *cimage, RIF_Image *image, uint32_t microseconds, bool *done);
+
+RIF_CImage* librif_image_compress(RIF_Image *source, const RIF_EncodeOptions *options);
+bool librif_cimage_write(RIF_CImage *image, const char *filename);
+
+#ifndef RIF_PLAYDATE
+RIF_Image* librif_cimage_decompress_parallel(RIF_CImage *cimage, RIF_Pool *pool, int nthreads);
+
+// NULL if the load can't be started, the worker allocates from pool without locking,
+// so the pool belongs to the load until its state isn't RIF_AsyncLoading
+RIF_AsyncLoad* librif_image_open_async(const char *filename, RIF_Pool *pool, RIF_AsyncCallback callback, void *userdata);
+RIF_AsyncLoad* librif_cimage_open_async(const char *filename, RIF_Pool *pool, RIF_AsyncCallback callback, void *userdata);
+RIF_AsyncState librif_async_get_state(RIF_AsyncLoad *load);
+void librif_async_get_progress(RIF_AsyncLoad *load, size_t *readBytes, size_t *totalBytes);
+RIF_AsyncState librif_async_wait(RIF_AsyncLoad *load);
+RIF_Image* librif_async_take_image(RIF_AsyncLoad *load);
+RIF_CImage* librif_async_take_cimage(RIF_AsyncLoad *load);
+void librif_async_free(RIF_AsyncLoad *load);
+#endif
 void librif_cimage_free(RIF_CImage *image);
 
+#ifdef RIF_TRACE
+void librif_trace_reset(void);
+RIF_TraceSummary librif_trace_get_summary(void);
+const char* librif_trace_phase_name(RIF_TracePhase phase);
+// Chrome trace-event JSON, for chrome://tracing or Perfetto
+bool librif_trace_write(const char *filename);
+#endif
+
 #endif /* librif_h */
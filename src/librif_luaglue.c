@@ -13,13 +13,27 @@ static RIF_Image* getImage(int n);
 static RIF_CImage* getCImage(int n);
 static RIF_Pool* getPool(int n);
 
+static uint8_t* getPixelsBuffer(size_t size);
+static int pushPixels(RIF_Image *image, RIF_CImage *cimage);
+static int pushSamples(RIF_Image *image, RIF_CImage *cimage);
+
 static const lua_reg librif_image[];
 static const lua_reg librif_cimage[];
 static const lua_reg librif_pool[];
+#ifdef RIF_TRACE
+static const lua_reg librif_trace[];
+#endif
 
 static char *kImageClass = "librif.image";
 static char *kCImageClass = "librif.cimage";
 static char *kPoolClass = "librif.pool";
+#ifdef RIF_TRACE
+static char *kTraceClass = "librif.trace";
+#endif
+
+// reused between calls to getPixels and sampleMany
+static uint8_t *pixelsBuffer = NULL;
+static size_t pixelsBufferSize = 0;
 
 // toybox register
 void register_librif(PlaydateAPI *pd){
@@ -42,6 +56,12 @@ void librif_register_lua(void){
     if(!RIF_pd->lua->registerClass(kPoolClass, librif_pool, NULL, 0, &err)){
         RIF_pd->system->logToConsole("%s:%i: registerClass failed, %s", __FILE__, __LINE__, err);
     }
+    
+    #ifdef RIF_TRACE
+    if(!RIF_pd->lua->registerClass(kTraceClass, librif_trace, NULL, 0, &err)){
+        RIF_pd->system->logToConsole("%s:%i: registerClass failed, %s", __FILE__, __LINE__, err);
+    }
+    #endif
 }
 
 static int pool_new(lua_State *L){
@@ -49,6 +69,10 @@ static int pool_new(lua_State *L){
     size_t size = RIF_pd->lua->getArgFloat(1);
     
     RIF_Pool *pool = librif_pool_new(size);
+    if(pool == NULL){
+        RIF_pd->lua->pushNil();
+        return 1;
+    }
     
     LuaUDObject *UDObject = RIF_pd->lua->pushObject(pool, kPoolClass, 0);
     RIF_pd->lua->retainObject(UDObject);
@@ -63,6 +87,29 @@ static int pool_clear(lua_State *L){
     return 0;
 }
 
+static int pool_mark(lua_State *L){
+    RIF_Pool *pool = getPool(1);
+    RIF_pd->lua->pushInt((int)librif_pool_mark(pool));
+    
+    return 1;
+}
+
+static int pool_rewind(lua_State *L){
+    RIF_Pool *pool = getPool(1);
+    RIF_PoolMark mark = RIF_pd->lua->getArgInt(2);
+    librif_pool_rewind(pool, mark);
+    
+    return 0;
+}
+
+static int pool_requiredSize(lua_State *L){
+    const char *filename = RIF_pd->lua->getArgString(1);
+    bool compressed = !RIF_pd->lua->argIsNil(2) && RIF_pd->lua->getArgBool(2);
+    RIF_pd->lua->pushInt((int)librif_pool_required_size(filename, compressed));
+    
+    return 1;
+}
+
 static int pool_realloc(lua_State *L){
     RIF_Pool *pool = getPool(1);
     size_t size = RIF_pd->lua->getArgInt(2);
@@ -92,12 +139,64 @@ static int pool_gc(lua_State *L){
 static const lua_reg librif_pool[] = {
     { "new", pool_new },
     { "clear", pool_clear },
+    { "mark", pool_mark },
+    { "rewind", pool_rewind },
+    { "requiredSize", pool_requiredSize },
     { "realloc", pool_realloc },
     { "release", pool_release },
     { "__gc", pool_gc },
     { NULL, NULL }
 };
 
+#ifdef RIF_TRACE
+static int trace_reset(lua_State *L){
+    librif_trace_reset();
+    
+    return 0;
+}
+
+static int trace_write(lua_State *L){
+    const char *filename = RIF_pd->lua->getArgString(1);
+    RIF_pd->lua->pushBool(librif_trace_write(filename));
+    
+    return 1;
+}
+
+static int trace_phaseCount(lua_State *L){
+    RIF_pd->lua->pushInt(RIF_TracePhaseCount);
+    
+    return 1;
+}
+
+// name, calls, time in ms, bytes, reads, allocations of the phase at index (1-based)
+static int trace_phase(lua_State *L){
+    int phase = RIF_pd->lua->getArgInt(1) - 1;
+    if(phase < 0 || phase >= RIF_TracePhaseCount){
+        return 0;
+    }
+    
+    RIF_TraceSummary summary = librif_trace_get_summary();
+    RIF_TracePhaseSummary *phaseSummary = &summary.phases[phase];
+    
+    RIF_pd->lua->pushString(librif_trace_phase_name(phase));
+    RIF_pd->lua->pushInt(phaseSummary->calls);
+    RIF_pd->lua->pushFloat(phaseSummary->time / 1000.0f);
+    RIF_pd->lua->pushInt((int)phaseSummary->bytes);
+    RIF_pd->lua->pushInt(phaseSummary->reads);
+    RIF_pd->lua->pushInt(phaseSummary->allocations);
+    
+    return 6;
+}
+
+static const lua_reg librif_trace[] = {
+    { "reset", trace_reset },
+    { "write", trace_write },
+    { "phaseCount", trace_phaseCount },
+    { "phase", trace_phase },
+    { NULL, NULL }
+};
+#endif
+
 static int image_open(lua_State *L){
     const char *filename = RIF_pd->lua->getArgString(1);
     
@@ -138,6 +237,21 @@ static int image_read(lua_State *L){
     return 2;
 }
 
+// budget in milliseconds
+static int image_readBudget(lua_State *L){
+    RIF_Image *image = getImage(1);
+    
+    uint32_t microseconds = RIF_pd->lua->getArgFloat(2) * 1000;
+    
+    bool closed;
+    bool success = librif_image_read_budget(image, microseconds, &closed);
+    
+    RIF_pd->lua->pushBool(success ? 1 : 0);
+    RIF_pd->lua->pushBool(closed ? 1 : 0);
+
+    return 2;
+}
+
 static int image_getWidth(lua_State *L){
     RIF_Image *image = getImage(1);
     RIF_pd->lua->pushInt(image->width);
@@ -188,6 +302,16 @@ static int image_getPixel(lua_State *L){
     return 2;
 }
 
+static int image_getPixels(lua_State *L){
+    RIF_Image *image = getImage(1);
+    return pushPixels(image, NULL);
+}
+
+static int image_sampleMany(lua_State *L){
+    RIF_Image *image = getImage(1);
+    return pushSamples(image, NULL);
+}
+
 static int image_setPixel(lua_State *L){
     RIF_Image *image = getImage(1);
     
@@ -222,10 +346,13 @@ static int image_gc(lua_State *L){
 static const lua_reg librif_image[] = {
     { "open", image_open },
     { "read", image_read },
+    { "readBudget", image_readBudget },
     { "getWidth", image_getWidth },
     { "getHeight", image_getHeight },
     { "hasAlpha", image_hasAlpha },
     { "getPixel", image_getPixel },
+    { "getPixels", image_getPixels },
+    { "sampleMany", image_sampleMany },
     { "setPixel", image_setPixel },
     { "getReadBytes", image_getReadBytes },
     { "getTotalBytes", image_getTotalBytes },
@@ -278,6 +405,21 @@ static int cimage_read(lua_State *L){
     return 2;
 }
 
+// budget in milliseconds
+static int cimage_readBudget(lua_State *L){
+    RIF_CImage *image = getCImage(1);
+    
+    uint32_t microseconds = RIF_pd->lua->getArgFloat(2) * 1000;
+    
+    bool closed;
+    bool success = librif_cimage_read_budget(image, microseconds, &closed);
+    
+    RIF_pd->lua->pushBool(success ? 1 : 0);
+    RIF_pd->lua->pushBool(closed ? 1 : 0);
+
+    return 2;
+}
+
 static int cimage_getWidth(lua_State *L){
     RIF_CImage *image = getCImage(1);
     RIF_pd->lua->pushInt(image->width);
@@ -327,6 +469,16 @@ static int cimage_getPixel(lua_State *L){
     
     return 2;
 }
+
+static int cimage_getPixels(lua_State *L){
+    RIF_CImage *image = getCImage(1);
+    return pushPixels(NULL, image);
+}
+
+static int cimage_sampleMany(lua_State *L){
+    RIF_CImage *image = getCImage(1);
+    return pushSamples(NULL, image);
+}
     
 static int cimage_decompress(lua_State *L){
     RIF_CImage *cimage = getCImage(1);
@@ -340,11 +492,77 @@ static int cimage_decompress(lua_State *L){
     
     RIF_Image *image = librif_cimage_decompress(cimage, pool);
     
-    RIF_pd->lua->pushObject(image, kImageClass, 0);
+    if(image != NULL){
+        RIF_pd->lua->pushObject(image, kImageClass, 0);
+    }
+    else {
+        RIF_pd->lua->pushNil();
+    }
     
     return 1;
 }
 
+// returns an image object, the compressed image is never kept
+static int cimage_openDecompressed(lua_State *L){
+    const char *filename = RIF_pd->lua->getArgString(1);
+    
+    RIF_Pool *pool = NULL;
+    
+    void *poolArg = RIF_pd->lua->getArgObject(2, kPoolClass, NULL);
+    if(poolArg != NULL){
+        pool = poolArg;
+    }
+    
+    RIF_Image *image = librif_cimage_open_decompressed(filename, pool);
+    
+    if(image != NULL){
+        RIF_pd->lua->pushObject(image, kImageClass, 0);
+    }
+    else {
+        RIF_pd->lua->pushNil();
+    }
+    
+    return 1;
+}
+
+static int cimage_decompressBegin(lua_State *L){
+    RIF_CImage *cimage = getCImage(1);
+
+    RIF_Pool *pool = NULL;
+    
+    void *poolArg = RIF_pd->lua->getArgObject(2, kPoolClass, NULL);
+    if(poolArg != NULL){
+        pool = poolArg;
+    }
+    
+    RIF_Image *image = librif_cimage_decompress_begin(cimage, pool);
+    
+    if(image != NULL){
+        RIF_pd->lua->pushObject(image, kImageClass, 0);
+    }
+    else {
+        RIF_pd->lua->pushNil();
+    }
+    
+    return 1;
+}
+
+// budget in milliseconds
+static int cimage_decompressBudget(lua_State *L){
+    RIF_CImage *cimage = getCImage(1);
+    RIF_Image *image = getImage(2);
+    
+    uint32_t microseconds = RIF_pd->lua->getArgFloat(3) * 1000;
+    
+    bool done;
+    bool success = librif_cimage_decompress_budget(cimage, image, microseconds, &done);
+    
+    RIF_pd->lua->pushBool(success ? 1 : 0);
+    RIF_pd->lua->pushBool(done ? 1 : 0);
+
+    return 2;
+}
+
 static int cimage_gc(lua_State *L){
     RIF_CImage *image = getCImage(0);
     librif_cimage_free(image);
@@ -354,14 +572,20 @@ static int cimage_gc(lua_State *L){
 
 static const lua_reg librif_cimage[] = {
     { "open", cimage_open },
+    { "openDecompressed", cimage_openDecompressed },
     { "read", cimage_read },
+    { "readBudget", cimage_readBudget },
     { "getWidth", cimage_getWidth },
     { "getHeight", cimage_getHeight },
     { "hasAlpha", cimage_hasAlpha },
     { "getPixel", cimage_getPixel },
+    { "getPixels", cimage_getPixels },
+    { "sampleMany", cimage_sampleMany },
     { "getReadBytes", cimage_getReadBytes },
     { "getTotalBytes", cimage_getTotalBytes },
     { "decompress", cimage_decompress },
+    { "decompressBegin", cimage_decompressBegin },
+    { "decompressBudget", cimage_decompressBudget },
     { "__gc", cimage_gc },
     { NULL, NULL }
 };
@@ -387,3 +611,109 @@ static RIF_CImage* getCImage(int n){
 static RIF_Pool* getPool(int n){
     return getObject(n, kPoolClass);
 }
+
+// NULL if the buffer can't grow, the previous one is kept
+static uint8_t* getPixelsBuffer(size_t size){
+    if(size > pixelsBufferSize){
+        uint8_t *buffer = RIF_pd->system->realloc(pixelsBuffer, size);
+        if(buffer == NULL){
+            return NULL;
+        }
+        pixelsBuffer = buffer;
+        pixelsBufferSize = size;
+    }
+    return pixelsBuffer;
+}
+
+// getPixels(x, y, width, height, [alpha]), returns the rectangle as a string,
+// nil if it doesn't fit in memory
+static int pushPixels(RIF_Image *image, RIF_CImage *cimage){
+    
+    int x = RIF_pd->lua->getArgInt(2);
+    int y = RIF_pd->lua->getArgInt(3);
+    int width = RIF_pd->lua->getArgInt(4);
+    int height = RIF_pd->lua->getArgInt(5);
+    
+    bool alpha = !RIF_pd->lua->argIsNil(6) && RIF_pd->lua->getArgBool(6);
+    
+    if(width <= 0 || height <= 0){
+        RIF_pd->lua->pushBytes("", 0);
+        return 1;
+    }
+    
+    RIF_PixelFormat format = alpha ? RIF_PixelFormatColorAlpha : RIF_PixelFormatColor;
+    size_t rowSize = (size_t)width * (alpha ? 2 : 1);
+    
+    // sizes come from Lua, the rect must not overflow int coordinates or the buffer size
+    if(x > INT32_MAX - width || y > INT32_MAX - height || (size_t)height > SIZE_MAX / rowSize){
+        RIF_pd->lua->pushNil();
+        return 1;
+    }
+    
+    uint8_t *buffer = getPixelsBuffer(rowSize * height);
+    if(buffer == NULL){
+        RIF_pd->lua->pushNil();
+        return 1;
+    }
+    
+    if(image != NULL){
+        librif_image_copy_rect(image, x, y, width, height, buffer, rowSize, format);
+    }
+    else {
+        librif_cimage_copy_rect(cimage, x, y, width, height, buffer, rowSize, format);
+    }
+    
+    RIF_pd->lua->pushBytes((char*)buffer, rowSize * height);
+    
+    return 1;
+}
+
+// sampleMany(xs, ys, [alpha]), coordinates are strings of packed int32 (string.pack("i4", ...)),
+// nil if the result doesn't fit in memory
+static int pushSamples(RIF_Image *image, RIF_CImage *cimage){
+    
+    size_t xsLength = 0;
+    size_t ysLength = 0;
+    
+    const char *xs = RIF_pd->lua->getArgBytes(2, &xsLength);
+    const char *ys = RIF_pd->lua->getArgBytes(3, &ysLength);
+    
+    bool alpha = !RIF_pd->lua->argIsNil(4) && RIF_pd->lua->getArgBool(4);
+    
+    if(xs == NULL || ys == NULL){
+        RIF_pd->lua->pushBytes("", 0);
+        return 1;
+    }
+    
+    size_t count = (xsLength < ysLength ? xsLength : ysLength) / sizeof(int32_t);
+    size_t pixelSize = alpha ? 2 : 1;
+    
+    uint8_t *buffer = getPixelsBuffer(count * pixelSize > 0 ? count * pixelSize : 1);
+    if(buffer == NULL){
+        RIF_pd->lua->pushNil();
+        return 1;
+    }
+    
+    for(size_t i = 0; i < count; i++){
+        int32_t x, y;
+        memcpy(&x, &xs[i * sizeof(int32_t)], sizeof(int32_t));
+        memcpy(&y, &ys[i * sizeof(int32_t)], sizeof(int32_t));
+        
+        uint8_t color, pixelAlpha;
+        if(image != NULL){
+            librif_image_get_pixel(image, x, y, &color, &pixelAlpha);
+        }
+        else {
+            librif_cimage_get_pixel(cimage, x, y, &color, &pixelAlpha);
+        }
+        
+        buffer[i * pixelSize] = color;
+        if(alpha){
+            buffer[i * pixelSize + 1] = pixelAlpha;
+        }
+    }
+    
+    RIF_pd->lua->pushBytes((char*)buffer, count * pixelSize);
+    
+    return 1;
+}